@@ -0,0 +1,24 @@
+# round trip latency over tcp loopback, which goes through the libzmq io threads.
+# compare runs with and without pinning, e.g.
+#   mruby bench/affinity.rb
+#   ZMQ_THREAD_AFFINITY_CPU_ADD=2 mruby bench/affinity.rb
+# usage: mruby bench/affinity.rb [iterations]
+
+iterations = (ARGV[0] || 20_000).to_i
+
+rep = ZMQ::Rep.new("tcp://127.0.0.1:*")
+req = ZMQ::Req.new(rep.last_endpoint)
+
+samples = []
+iterations.times do
+  started = Time.now
+  req.send("ping")
+  rep.recv
+  rep.send("pong")
+  req.recv
+  samples << (Time.now - started) * 1_000_000
+end
+
+samples.sort!
+puts sprintf("%-12s %10d iterations p50 %8.1f us p99 %8.1f us max %8.1f us", "round trip", iterations,
+  samples[samples.size / 2], samples[samples.size * 99 / 100], samples.last)
@@ -0,0 +1,8 @@
+# optimized build without sanitizers for rake bench
+MRuby::Build.new('bench') do |conf|
+  toolchain :gcc
+  conf.cc.flags << '-O2'
+  conf.cxx.flags << '-O2'
+  conf.gembox 'default'
+  conf.gem File.expand_path(File.join(File.dirname(__FILE__), '..'))
+end
@@ -0,0 +1,39 @@
+# compares sending one payload to many sockets with a new Msg per socket against Msg#send_to_all
+# usage: mruby bench/fanout.rb [iterations] [sockets] [size]
+
+iterations = (ARGV[0] || 1_000).to_i
+n_sockets = (ARGV[1] || 200).to_i
+size = (ARGV[2] || 1024 * 1024).to_i
+
+def measure(name, iterations)
+  started = Time.now
+  yield
+  elapsed = Time.now - started
+  puts sprintf("%-12s %10d iterations %8.3f s %12.0f ops/s", name, iterations, elapsed, iterations / elapsed)
+end
+
+pulls = []
+pushes = []
+n_sockets.times do |i|
+  pulls << ZMQ::Pull.new("inproc://mrb-zmq-bench-fanout-#{i}")
+  pushes << ZMQ::Push.new("inproc://mrb-zmq-bench-fanout-#{i}")
+end
+snapshot = "s" * size
+
+def drain(pulls)
+  pulls.each { |pull| pull.recv.close! }
+end
+
+measure("msg per sock", iterations) do
+  iterations.times do
+    pushes.each { |push| ZMQ::Msg.new(snapshot).send(push) }
+    drain(pulls)
+  end
+end
+
+measure("send_to_all", iterations) do
+  iterations.times do
+    ZMQ::Msg.new(snapshot).send_to_all(pushes)
+    drain(pulls)
+  end
+end
@@ -0,0 +1,27 @@
+# measures what ZMQ::Logger costs the calling thread, for filtered and for buffered entries
+# usage: mruby bench/logger.rb [iterations]
+
+iterations = (ARGV[0] || 100_000).to_i
+
+def measure(name, iterations)
+  started = Time.now
+  yield
+  elapsed = Time.now - started
+  puts sprintf("%-12s %10d iterations %8.3f s %12.0f ops/s", name, iterations, elapsed, iterations / elapsed)
+end
+
+sub = ZMQ::Sub.new("inproc://mrb-zmq-bench-logger")
+logger = ZMQ::Logger.new("inproc://mrb-zmq-bench-logger", "bench", level: :info, stdout: false, capacity: iterations)
+
+measure("filtered", iterations) do
+  iterations.times { logger.debug("request handled") }
+end
+
+measure("buffered", iterations) do
+  iterations.times { logger.info("request handled") }
+end
+
+logger.flush
+puts logger.stats.inspect
+logger.close
+sub.close
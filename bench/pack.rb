@@ -0,0 +1,34 @@
+# compares Msg.pack/Msg#unpack with framing a message by hand through String#pack and String#unpack
+# usage: mruby bench/pack.rb [iterations]
+
+iterations = (ARGV[0] || 100_000).to_i
+
+def measure(name, iterations)
+  started = Time.now
+  yield
+  elapsed = Time.now - started
+  puts sprintf("%-12s %10d iterations %8.3f s %12.0f ops/s", name, iterations, elapsed, iterations / elapsed)
+end
+
+command = "update"
+id = 123456789
+score = 0.75
+payload = "x" * 256
+
+measure("String#pack", iterations) do
+  iterations.times do
+    msg = ZMQ::Msg.new([command.bytesize].pack("N") << command << [id, score, payload.bytesize].pack("q>EN") << payload)
+    data = msg.to_str
+    command_size = data.unpack("N").first
+    decoded_command = data.byteslice(4, command_size)
+    decoded_id, decoded_score, payload_size = data.byteslice(4 + command_size, 20).unpack("q>EN")
+    decoded_payload = data.byteslice(24 + command_size, payload_size)
+  end
+end
+
+measure("Msg.pack", iterations) do
+  iterations.times do
+    msg = ZMQ::Msg.pack([command, id, score, payload])
+    decoded_command, decoded_id, decoded_score, decoded_payload = msg.unpack
+  end
+end
@@ -0,0 +1,41 @@
+# compares ZMQ::Reactor with the equivalent poller/timers loop written in ruby
+# usage: mruby bench/reactor.rb [iterations]
+
+iterations = (ARGV[0] || 100_000).to_i
+
+def measure(name, iterations)
+  started = Time.now
+  yield
+  elapsed = Time.now - started
+  puts sprintf("%-12s %10d iterations %8.3f s %12.0f ops/s", name, iterations, elapsed, iterations / elapsed)
+end
+
+pull = ZMQ::Pull.new("inproc://mrb-zmq-bench-reactor")
+push = ZMQ::Push.new("inproc://mrb-zmq-bench-reactor")
+
+poller = ZMQ::Poller.new
+poller << pull
+timers = ZMQ::Timers.new
+timers.add(1000) {}
+
+measure("ruby loop", iterations) do
+  iterations.times do
+    push.send("ping")
+    poller.wait(timers.timeout) do |socket, events|
+      socket.recv
+    end
+    timers.execute
+  end
+end
+poller.remove(pull)
+
+reactor = ZMQ::Reactor.new
+reactor.add(pull) { |socket, events| socket.recv }
+reactor.timers.add(1000) {}
+
+measure("reactor", iterations) do
+  iterations.times do
+    push.send("ping")
+    reactor.run_once
+  end
+end
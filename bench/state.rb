@@ -0,0 +1,28 @@
+# measures the per call overhead of socket creation and recv, which both used to resolve
+# LibZMQ::__CTX__ or ZMQ::Msg by name on every call.
+# usage: mruby bench/state.rb [iterations]
+
+iterations = (ARGV[0] || 100_000).to_i
+
+def measure(name, iterations)
+  started = Time.now
+  yield
+  elapsed = Time.now - started
+  puts sprintf("%-12s %10d iterations %8.3f s %12.0f ops/s", name, iterations, elapsed, iterations / elapsed)
+end
+
+measure("socket.new", iterations) do
+  iterations.times do
+    ZMQ::Socket.new(LibZMQ::PUSH).close
+  end
+end
+
+pull = ZMQ::Pull.new("inproc://mrb-zmq-bench-state")
+push = ZMQ::Push.new("inproc://mrb-zmq-bench-state")
+
+measure("recv", iterations) do
+  iterations.times do
+    push.send("ping")
+    pull.recv
+  end
+end
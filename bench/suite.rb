@@ -0,0 +1,125 @@
+# libzmq style local_thr/remote_thr and local_lat/remote_lat over inproc, ipc and tcp loopback,
+# for message sizes from 1 B to 1 MB and for the Socket#send, LibZMQ.send and Msg#send paths.
+# The remote side runs in a ZMQ::Thread, every result is written as one json line to the output file.
+# usage: mruby bench/suite.rb [output] [scale]
+#   scale multiplies the message counts, e.g. 0.1 for a quick run
+
+output = ARGV[0] || "bench/results.jsonl"
+scale = (ARGV[1] || 1).to_f
+
+SIZES = [1, 16, 256, 4096, 65536, 1048576]
+PATHS = ["socket", "libzmq", "msg"]
+TRANSPORTS = ["inproc", "tcp"]
+TRANSPORTS << "ipc" if LibZMQ.has?("ipc")
+
+# how the remote side sends, this has to match sender below
+SEND = <<-RUBY
+  case path
+  when "socket" then lambda {|socket, data| socket.send(data)}
+  when "libzmq" then lambda {|socket, data| LibZMQ.send(socket, data, 0)}
+  else lambda {|socket, data| ZMQ::Msg.new(data).send(socket)}
+  end
+RUBY
+
+REMOTE_THR = <<-RUBY
+  lambda do |pipe, endpoint, count, size, path|
+    sender = #{SEND}
+    push = ZMQ::Push.new(endpoint)
+    data = "x" * size
+    count.times { sender.call(push, data) }
+    pipe.recv
+    push.close
+    nil
+  end
+RUBY
+
+LOCAL_LAT = <<-RUBY
+  lambda do |pipe, endpoint, count, size, path|
+    sender = #{SEND}
+    rep = ZMQ::Rep.new(endpoint, :connect)
+    count.times { sender.call(rep, rep.recv.to_str) }
+    rep.close
+    nil
+  end
+RUBY
+
+def endpoint(transport, name)
+  case transport
+  when "inproc" then "inproc://mrb-zmq-bench-#{name}"
+  when "ipc" then "ipc://mrb-zmq-bench-#{name}.ipc"
+  else "tcp://127.0.0.1:*"
+  end
+end
+
+def count_for(size, bytes, min, max, scale)
+  count = (bytes / size * scale).to_i
+  count = min if count < min
+  count = max if count > max
+  count
+end
+
+def sender(path)
+  case path
+  when "socket" then lambda {|socket, data| socket.send(data)}
+  when "libzmq" then lambda {|socket, data| LibZMQ.send(socket, data, 0)}
+  else lambda {|socket, data| ZMQ::Msg.new(data).send(socket)}
+  end
+end
+
+# local_thr, messages are counted from the first one received like libzmq's perf tools do
+def throughput(transport, size, path, scale)
+  count = count_for(size, 256 * 1024 * 1024, 100, 1_000_000, scale)
+  pull = ZMQ::Pull.new(endpoint(transport, "thr"))
+  thread = ZMQ::Thread.new(REMOTE_THR, pull.last_endpoint, count, size, path)
+  pull.recv
+  started = Time.now
+  (count - 1).times { pull.recv }
+  elapsed = Time.now - started
+  thread.pipe.send("done")
+  thread.join
+  pull.close
+  msgs_per_sec = (count - 1) / elapsed
+  { "scenario" => "thr", "transport" => transport, "size" => size, "path" => path, "count" => count,
+    "elapsed" => elapsed, "msgs_per_sec" => msgs_per_sec, "mbit_per_sec" => msgs_per_sec * size * 8 / 1_000_000 }
+end
+
+# remote_lat, the average round trip halved
+def latency(transport, size, path, scale)
+  count = count_for(size, 64 * 1024 * 1024, 100, 10_000, scale)
+  req = ZMQ::Req.new(endpoint(transport, "lat"), true)
+  thread = ZMQ::Thread.new(LOCAL_LAT, req.last_endpoint, count, size, path)
+  send = sender(path)
+  data = "x" * size
+  started = Time.now
+  count.times do
+    send.call(req, data)
+    req.recv
+  end
+  elapsed = Time.now - started
+  thread.join
+  req.close
+  { "scenario" => "lat", "transport" => transport, "size" => size, "path" => path, "count" => count,
+    "elapsed" => elapsed, "latency_us" => elapsed / count / 2 * 1_000_000 }
+end
+
+def to_json(result)
+  "{" + result.map do |key, value|
+    value = value.is_a?(String) ? value.inspect : (value.is_a?(Float) ? sprintf("%.3f", value) : value.to_s)
+    "#{key.inspect}: #{value}"
+  end.join(", ") + "}"
+end
+
+lines = []
+TRANSPORTS.each do |transport|
+  SIZES.each do |size|
+    PATHS.each do |path|
+      [throughput(transport, size, path, scale), latency(transport, size, path, scale)].each do |result|
+        line = to_json(result)
+        puts line
+        lines << line
+      end
+    end
+  end
+end
+
+File.open(output, "w") { |f| f.write(lines.join("\n") + "\n") }
@@ -0,0 +1,46 @@
+# compares polling a empty socket with recv(DONTWAIT) and rescue against try_recv,
+# and a Push without peers, which never can send, with send(DONTWAIT) and rescue against try_send.
+# usage: mruby bench/try.rb [iterations]
+
+iterations = (ARGV[0] || 1_000_000).to_i
+
+def measure(name, iterations)
+  started = Time.now
+  yield
+  elapsed = Time.now - started
+  puts sprintf("%-12s %10d iterations %8.3f s %12.0f ops/s", name, iterations, elapsed, iterations / elapsed)
+end
+
+pull = ZMQ::Pull.new("inproc://mrb-zmq-bench-try")
+
+measure("recv rescue", iterations) do
+  iterations.times do
+    begin
+      pull.recv(LibZMQ::DONTWAIT)
+    rescue Errno::EAGAIN
+    end
+  end
+end
+
+measure("try_recv", iterations) do
+  iterations.times do
+    pull.try_recv
+  end
+end
+
+push = ZMQ::Push.new
+
+measure("send rescue", iterations) do
+  iterations.times do
+    begin
+      push.send("ping", LibZMQ::DONTWAIT)
+    rescue Errno::EAGAIN
+    end
+  end
+end
+
+measure("try_send", iterations) do
+  iterations.times do
+    push.try_send("ping")
+  end
+end
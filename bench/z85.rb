@@ -0,0 +1,46 @@
+# compares ZMQ::Z85 with zmq_z85_encode/zmq_z85_decode through LibZMQ
+# usage: mruby bench/z85.rb [iterations] [size]
+
+iterations = (ARGV[0] || 100_000).to_i
+size = (ARGV[1] || 1024).to_i / 4 * 4
+
+def measure(name, iterations)
+  started = Time.now
+  yield
+  elapsed = Time.now - started
+  puts sprintf("%-12s %10d iterations %8.3f s %12.0f ops/s", name, iterations, elapsed, iterations / elapsed)
+end
+
+data = "\xA5" * size
+encoded = LibZMQ.z85_encode(data)
+
+measure("libzmq enc", iterations) do
+  iterations.times { LibZMQ.z85_encode(data) }
+end
+
+measure("z85 enc", iterations) do
+  iterations.times { ZMQ::Z85.encode(data) }
+end
+
+buffer = ""
+measure("z85 enc_into", iterations) do
+  iterations.times do
+    buffer.clear
+    ZMQ::Z85.encode_into(buffer, data)
+  end
+end
+
+measure("libzmq dec", iterations) do
+  iterations.times { LibZMQ.z85_decode(encoded) }
+end
+
+measure("z85 dec", iterations) do
+  iterations.times { ZMQ::Z85.decode(encoded) }
+end
+
+measure("z85 dec_into", iterations) do
+  iterations.times do
+    buffer.clear
+    ZMQ::Z85.decode_into(buffer, encoded)
+  end
+end
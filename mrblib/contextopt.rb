@@ -29,7 +29,8 @@ module ZMQ
     end
   end
 
-  ["max_msgsz", "max_sockets"].each do |contextopt|
+  # the thread_ options only take effect when set before the first socket has been created
+  ["max_msgsz", "max_sockets", "thread_sched_policy", "thread_priority", "thread_name_prefix"].each do |contextopt|
     optup = contextopt.upcase
     if LibZMQ.const_defined?(optup)
       const = LibZMQ.const_get(optup)
@@ -38,4 +39,79 @@ module ZMQ
       end
     end
   end
+
+  ["thread_affinity_cpu_add", "thread_affinity_cpu_remove"].each do |contextopt|
+    optup = contextopt.upcase
+    if LibZMQ.const_defined?(optup)
+      const = LibZMQ.const_get(optup)
+      define_singleton_method(contextopt) do |cpu|
+        LibZMQ.ctx_set(const, cpu)
+      end
+    end
+  end
+
+  class Context
+    # ZMQ::Context.new(io_threads: 2, max_sockets: 4096)
+    def setopts(options)
+      options.each do |option_name, option_value|
+        send("#{option_name}=", option_value)
+      end
+      self
+    end
+
+    ["ipv6", "blocky"].each do |contextopt|
+      optup = contextopt.upcase
+      if LibZMQ.const_defined?(optup)
+        const = LibZMQ.const_get(optup)
+        define_method("#{contextopt}?") do
+          get(const) == 1
+        end
+      end
+    end
+
+    ["io_threads", "max_sockets", "max_msgsz", "socket_limit", "msg_t_size"].each do |contextopt|
+      optup = contextopt.upcase
+      if LibZMQ.const_defined?(optup)
+        const = LibZMQ.const_get(optup)
+        define_method(contextopt) do
+          get(const)
+        end
+      end
+    end
+
+    ["blocky", "ipv6"].each do |contextopt|
+      optup = contextopt.upcase
+      if LibZMQ.const_defined?(optup)
+        const = LibZMQ.const_get(optup)
+        define_method("#{contextopt}=") do |option_value|
+          set(const, option_value ? 1 : 0)
+        end
+      end
+    end
+
+    ["io_threads", "max_msgsz", "max_sockets", "thread_sched_policy", "thread_priority", "thread_name_prefix"].each do |contextopt|
+      optup = contextopt.upcase
+      if LibZMQ.const_defined?(optup)
+        const = LibZMQ.const_get(optup)
+        define_method("#{contextopt}=") do |option_value|
+          set(const, option_value)
+        end
+      end
+    end
+
+    ["thread_affinity_cpu_add", "thread_affinity_cpu_remove"].each do |contextopt|
+      optup = contextopt.upcase
+      if LibZMQ.const_defined?(optup)
+        const = LibZMQ.const_get(optup)
+        define_method(contextopt) do |cpu|
+          set(const, cpu)
+        end
+      end
+    end
+
+    # ZMQ::Context.new(thread_affinity_cpus: [2, 3]) pins the io threads to cpus 2 and 3
+    def thread_affinity_cpus=(cpus)
+      cpus.each {|cpu| thread_affinity_cpu_add(cpu)}
+    end
+  end
 end
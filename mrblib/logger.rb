@@ -3,41 +3,81 @@ module ZMQ
     attr_accessor :logger
   end
 
+  # entries below level are discarded before anything is allocated for them,
+  # the rest are queued in a native buffer and written by a flush thread,
+  # every interval ms or once batch entries are waiting.
+  # Each batch goes out as one frame of newline separated "level, ident, time, message" lines.
   class Logger
-    def initialize(endpoint = nil, ident = nil)
-      @pub = ZMQ::Pub.new(endpoint, :connect) if endpoint
-      @ident = ident if ident
+    DEBUG = 0
+    INFO  = 1
+    WARN  = 2
+    ERROR = 3
+
+    LEVELS = { "D" => DEBUG, "I" => INFO, "W" => WARN, "E" => ERROR,
+               "debug" => DEBUG, "info" => INFO, "warn" => WARN, "error" => ERROR }
+
+    attr_reader :level
+
+    def initialize(endpoint = nil, ident = nil, level: ENV['ZMQ_LOGGER_LEVEL'], interval: 100, batch: 64, capacity: 4096, stdout: true)
+      self.level = level || DEBUG
+      pub = ZMQ::Pub.new(endpoint, :connect) if endpoint
+      @buffer = Buffer.new(pub, ident, interval, batch, capacity, stdout)
+    end
+
+    def level=(level)
+      @level = Logger.level(level)
+    end
+
+    def self.level(level)
+      return level if level.is_a?(Integer)
+      LEVELS[level.to_s] || LEVELS[level.to_s.downcase] || raise(ArgumentError, "unknown log level #{level}")
     end
 
+    # returns false when the entry was filtered or dropped
     def log(level, message)
-      if @ident
-        msg = [level, @ident, Time.now.utc.to_s, message]
-      else
-        msg = [level, Time.now.utc.to_s, message]
-      end
-      puts msg.join(", ")
-      @pub.send(msg) if @pub
-      msg
+      level = Logger.level(level)
+      return false if level < @level
+      @buffer.push(level, message)
     end
 
     def debug(message)
-      log("D", message)
+      return false if @level > DEBUG
+      @buffer.push(DEBUG, message)
     end
 
     def error(message)
-      log("E", message)
+      return false if @level > ERROR
+      @buffer.push(ERROR, message)
     end
 
     def info(message)
-      log("I", message)
+      return false if @level > INFO
+      @buffer.push(INFO, message)
     end
 
     def warn(message)
-      log("W", message)
+      return false if @level > WARN
+      @buffer.push(WARN, message)
     end
 
     def crash(exception)
-      log("E", format_exception(exception))
+      return false if @level > ERROR
+      @buffer.push(ERROR, format_exception(exception))
+    end
+
+    # writes all queued entries now
+    def flush
+      @buffer.flush
+      self
+    end
+
+    # {queued:, written:, dropped:, batches:}, dropped counts entries lost to a full buffer or a full pub socket
+    def stats
+      @buffer.stats
+    end
+
+    def close
+      @buffer.close
     end
 
     def format_exception(exception)
@@ -4,6 +4,18 @@ module ZMQ
       LibZMQ.msg_send(self, socket, flags)
     end
 
+    # returns false instead of raising when the socket can't take the msg right now, the msg is kept then.
+    def try_send(socket, flags = 0)
+      LibZMQ.msg_try_send(self, socket, flags)
+    end
+
+    # sends the same payload to every socket without copying it, the msg stays usable.
+    # returns the bytes sent per socket, nil where it would have blocked with LibZMQ::DONTWAIT
+    # and the exception where sending failed otherwise. Closed sockets raise before anything is sent.
+    def send_to_all(sockets, flags = 0)
+      LibZMQ.msg_send_many(self, sockets, flags)
+    end
+
     def bytesize
       LibZMQ.msg_size(self)
     end
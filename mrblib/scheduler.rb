@@ -0,0 +1,174 @@
+module ZMQ
+  if ZMQ.const_defined?("Reactor")
+    # runs Fibers whose socket calls look blocking without stalling the interpreter.
+    # When a call would block the Fiber gets parked on its socket in one shared ZMQ::Reactor
+    # and resumed once the socket is ready, timeouts are ZMQ::Timers of the same reactor.
+    # recv, send, wait and sleep have to be called from a Fiber spawned by the scheduler.
+    #
+    #   scheduler = ZMQ::Scheduler.new
+    #   router = ZMQ::Router.new("tcp://127.0.0.1:5555")
+    #   scheduler.spawn do
+    #     loop do
+    #       peer, empty, request = scheduler.recv(router)
+    #       scheduler.send(router, [peer, empty, request.to_str.upcase])
+    #     end
+    #   end
+    #   scheduler.run
+    class Scheduler
+      class TimeoutError < StandardError; end
+
+      attr_reader :reactor
+
+      def initialize
+        @reactor = Reactor.new
+        @ready = [] # [fiber, value to resume it with]
+        @waiters = {} # socket => [[fiber, events, timer]]
+        @events = {} # socket => events it is registered with in the reactor
+        @dirty = {} # sockets whose waiters changed since the last sync
+        @sleeping = 0
+        @fibers = 0
+        @current = nil
+      end
+
+      # the Fiber starts running with the next run.
+      def spawn(*args, &block)
+        raise ArgumentError, "no block given" unless block
+        fiber = Fiber.new do
+          begin
+            block.call(*args)
+          ensure
+            @fibers -= 1
+          end
+        end
+        @fibers += 1
+        @ready << [fiber, nil]
+        fiber
+      end
+
+      # what Socket#recv returns, raises TimeoutError when nothing arrived within timeout ms.
+      def recv(socket, timeout = -1)
+        until (msg = socket.try_recv)
+          unless wait(socket, Poller::In, timeout)
+            raise TimeoutError, "recv timed out after #{timeout} ms"
+          end
+        end
+        msg
+      end
+
+      # takes what Socket#try_send takes, raises TimeoutError when the socket couldn't take it within timeout ms.
+      # A multipart message which went out partly is continued with its remaining frames.
+      def send(socket, data, timeout = -1)
+        until (sent = socket.try_send(data)) == true
+          data = data[sent..-1] if sent
+          unless wait(socket, Poller::Out, timeout)
+            raise TimeoutError, "send timed out after #{timeout} ms"
+          end
+        end
+        socket
+      end
+
+      # parks the current Fiber until socket has one of events, returns false when timeout ms passed first.
+      def wait(socket, events, timeout = -1)
+        fiber = current!
+        waiter = [fiber, events, nil]
+        if timeout >= 0
+          waiter[2] = @reactor.timers.add(timeout) do
+            waiter[2].cancel
+            if @waiters[socket].delete(waiter)
+              @dirty[socket] = true
+              @ready << [fiber, false]
+            end
+          end
+        end
+        (@waiters[socket] ||= []) << waiter
+        @dirty[socket] = true
+        Fiber.yield
+      end
+
+      def sleep(ms)
+        fiber = current!
+        @sleeping += 1
+        timer = @reactor.timers.add(ms) do
+          timer.cancel
+          @sleeping -= 1
+          @ready << [fiber, true]
+        end
+        Fiber.yield
+        self
+      end
+
+      # runs until every spawned Fiber has finished or the ones left wait for nothing.
+      def run
+        while @fibers > 0
+          run_ready
+          sync
+          break if @fibers == 0 || (@waiters.empty? && @sleeping == 0)
+          @reactor.run_once
+        end
+        self
+      end
+
+      def size
+        @fibers
+      end
+
+      private
+
+      def current!
+        @current || raise(FiberError, "not inside a Fiber spawned by this scheduler")
+      end
+
+      def run_ready
+        until @ready.empty?
+          ready = @ready
+          @ready = []
+          ready.each do |fiber, value|
+            @current = fiber
+            begin
+              fiber.resume(value)
+            ensure
+              @current = nil
+            end
+          end
+        end
+      end
+
+      def wake(socket, events)
+        waiters = @waiters[socket]
+        return unless waiters
+        waiters.delete_if do |fiber, wanted, timer|
+          if wanted & events != 0 || events & Poller::Err != 0
+            timer.cancel if timer
+            @ready << [fiber, true]
+            true
+          end
+        end
+        @dirty[socket] = true
+      end
+
+      # registers each changed socket with the union of what its waiters want, or removes it when none are left.
+      def sync
+        @dirty.each_key do |socket|
+          events = 0
+          waiters = @waiters[socket]
+          waiters.each {|_, wanted, _| events |= wanted} if waiters
+          registered = @events[socket]
+          if events == 0
+            @waiters.delete(socket)
+            if registered
+              @reactor.remove(socket)
+              @events.delete(socket)
+            end
+          elsif registered.nil?
+            @reactor.add(socket, events) {|ready_socket, ready_events| wake(ready_socket, ready_events)}
+            @events[socket] = events
+          elsif registered != events
+            @reactor.modify(socket, events)
+            @events[socket] = events
+          end
+        end
+        @dirty.clear
+      end
+    end
+  end
+end
@@ -27,17 +27,16 @@ module ZMQ
     end
 
     # this is just a helper method to write less code,
-    # if you are sendings lots of messages please use the LibZMQ.send method directly
+    # if you are sendings lots of messages please use the LibZMQ.send method directly.
+    # Raises Errno::EAGAIN when a multipart message could only be sent partly with LibZMQ::DONTWAIT,
+    # the rest of it has to be sent with LibZMQ.send_multipart before anything else.
     def send(data, flags = 0)
       case data
       when Array
-        i = 0
-        size = data.size - 1
-        while i < size
-          LibZMQ.send(self, data[i], LibZMQ::SNDMORE|flags)
-          i += 1
+        sent = LibZMQ.send_multipart(self, data, flags)
+        if sent < data.size
+          raise Errno::EAGAIN, "zmq_send: only #{sent} of #{data.size} frames were sent"
         end
-        LibZMQ.send(self, data[i], 0|flags)
       else
         LibZMQ.send(self, data, flags)
       end
@@ -49,10 +48,16 @@ module ZMQ
       self
     end
 
-    def monitor(events = LibZMQ::EVENT_ALL)
+    # uses version 2 events with 64 bit values and the remote endpoint when libzmq supports them.
+    def monitor(events = LibZMQ::EVENT_ALL, counters: false)
       endpoint = "inproc://mrb-zmq-monitor-#{object_id}"
-      LibZMQ.socket_monitor(self, endpoint, events)
-      Monitor.new(endpoint)
+      if LibZMQ.respond_to?(:socket_monitor_versioned)
+        LibZMQ.socket_monitor_versioned(self, endpoint, events, 2)
+        Monitor.new(endpoint, 2, counters)
+      else
+        LibZMQ.socket_monitor(self, endpoint, events)
+        Monitor.new(endpoint, 1, counters)
+      end
     end
 
     if LibZMQ.respond_to?("join")
@@ -70,8 +75,8 @@ module ZMQ
 
   if LibZMQ.const_defined?("CLIENT")
     class Server < Socket
-      def initialize(endpoint = nil, connect = false)
-        super(LibZMQ::SERVER)
+      def initialize(endpoint = nil, connect = false, **options)
+        super(LibZMQ::SERVER, **options)
         if endpoint
           if connect
             LibZMQ.connect(self, endpoint)
@@ -83,8 +88,8 @@ module ZMQ
     end
 
     class Client < Socket
-      def initialize(endpoint = nil, bind = false)
-        super(LibZMQ::CLIENT)
+      def initialize(endpoint = nil, bind = false, **options)
+        super(LibZMQ::CLIENT, **options)
         if endpoint
           if bind
             LibZMQ.bind(self, endpoint)
@@ -98,8 +103,8 @@ module ZMQ
 
   if LibZMQ.const_defined?("DISH")
     class Radio < Socket
-      def initialize(endpoint = nil, connect = false)
-        super(LibZMQ::RADIO)
+      def initialize(endpoint = nil, connect = false, **options)
+        super(LibZMQ::RADIO, **options)
         if endpoint
           if connect
             LibZMQ.connect(self, endpoint)
@@ -111,8 +116,8 @@ module ZMQ
     end
 
     class Dish < Socket
-      def initialize(endpoint = nil, groups = nil, bind = false)
-        super(LibZMQ::DISH)
+      def initialize(endpoint = nil, groups = nil, bind = false, **options)
+        super(LibZMQ::DISH, **options)
         if groups.respond_to?(:each)
           groups.each {|group| join(group)}
         elsif groups
@@ -130,8 +135,8 @@ module ZMQ
   end # Dish
 
   class Pub < Socket
-    def initialize(endpoint = nil, connect = false)
-      super(LibZMQ::PUB)
+    def initialize(endpoint = nil, connect = false, **options)
+      super(LibZMQ::PUB, **options)
       if endpoint
         if connect
           LibZMQ.connect(self, endpoint)
@@ -143,8 +148,8 @@ module ZMQ
   end
 
   class Sub < Socket
-    def initialize(endpoint = nil, subs = nil, bind = false)
-      super(LibZMQ::SUB)
+    def initialize(endpoint = nil, subs = nil, bind = false, **options)
+      super(LibZMQ::SUB, **options)
       if subs.respond_to?(:each)
         subs.each {|sub| subscribe(sub)}
       elsif subs
@@ -161,8 +166,8 @@ module ZMQ
   end
 
   class XPub < Socket
-    def initialize(endpoint = nil, connect = false)
-      super(LibZMQ::XPUB)
+    def initialize(endpoint = nil, connect = false, **options)
+      super(LibZMQ::XPUB, **options)
       if endpoint
         if connect
           LibZMQ.connect(self, endpoint)
@@ -174,8 +179,8 @@ module ZMQ
   end
 
   class XSub < Socket
-    def initialize(endpoint = nil, bind = false)
-      super(LibZMQ::XSUB)
+    def initialize(endpoint = nil, bind = false, **options)
+      super(LibZMQ::XSUB, **options)
       if endpoint
         if bind
           LibZMQ.bind(self, endpoint)
@@ -187,8 +192,8 @@ module ZMQ
   end
 
   class Pull < Socket
-    def initialize(endpoint = nil, connect = false)
-      super(LibZMQ::PULL)
+    def initialize(endpoint = nil, connect = false, **options)
+      super(LibZMQ::PULL, **options)
       if endpoint
         if connect
           LibZMQ.connect(self, endpoint)
@@ -200,8 +205,8 @@ module ZMQ
   end
 
   class Push < Socket
-    def initialize(endpoint = nil, bind = false)
-      super(LibZMQ::PUSH)
+    def initialize(endpoint = nil, bind = false, **options)
+      super(LibZMQ::PUSH, **options)
       if endpoint
         if bind
           LibZMQ.bind(self, endpoint)
@@ -213,8 +218,8 @@ module ZMQ
   end
 
   class Stream < Socket
-    def initialize(endpoint = nil, bind = false)
-      super(LibZMQ::STREAM)
+    def initialize(endpoint = nil, bind = false, **options)
+      super(LibZMQ::STREAM, **options)
       if endpoint
         if bind
           LibZMQ.bind(self, endpoint)
@@ -226,8 +231,8 @@ module ZMQ
   end
 
   class Pair < Socket
-    def initialize(endpoint = nil, bind = false)
-      super(LibZMQ::PAIR)
+    def initialize(endpoint = nil, bind = false, **options)
+      super(LibZMQ::PAIR, **options)
       if endpoint
         if bind
           LibZMQ.bind(self, endpoint)
@@ -239,8 +244,8 @@ module ZMQ
   end
 
   class Router < Socket
-    def initialize(endpoint = nil, connect = false)
-      super(LibZMQ::ROUTER)
+    def initialize(endpoint = nil, connect = false, **options)
+      super(LibZMQ::ROUTER, **options)
       if endpoint
         if connect
           LibZMQ.connect(self, endpoint)
@@ -252,8 +257,8 @@ module ZMQ
   end
 
   class Dealer < Socket
-    def initialize(endpoint = nil, bind = false)
-      super(LibZMQ::DEALER)
+    def initialize(endpoint = nil, bind = false, **options)
+      super(LibZMQ::DEALER, **options)
       if endpoint
         if bind
           LibZMQ.bind(self, endpoint)
@@ -265,8 +270,8 @@ module ZMQ
   end
 
   class Rep < Socket
-    def initialize(endpoint = nil, connect = false)
-      super(LibZMQ::REP)
+    def initialize(endpoint = nil, connect = false, **options)
+      super(LibZMQ::REP, **options)
       if endpoint
         if connect
           LibZMQ.connect(self, endpoint)
@@ -278,8 +283,8 @@ module ZMQ
   end
 
   class Req < Socket
-    def initialize(endpoint = nil, bind = false)
-      super(LibZMQ::REQ)
+    def initialize(endpoint = nil, bind = false, **options)
+      super(LibZMQ::REQ, **options)
       if endpoint
         if bind
           LibZMQ.bind(self, endpoint)
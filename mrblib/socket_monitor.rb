@@ -35,20 +35,34 @@ module ZMQ
         end
       end
 
-      attr_reader :zmq_socket
+      attr_reader :zmq_socket, :version
 
-      def initialize(endpoint)
+      # recv is implemented in C and decodes version 1 and 2 events without going through ruby.
+      # With counters: true events never reach ruby, a native thread counts them per event and endpoint instead.
+      def initialize(endpoint, version = 1, counters = false)
         @zmq_socket = ZMQ::Pair.new(endpoint)
+        @version = version
+        @events = Events
+        @counters = Counters.new(@zmq_socket, version) if counters
       end
 
-      def recv
-        msg, endpoint = @zmq_socket.recv
-        event, value = msg.to_str.unpack('SL')
-        {
-          event: Events[event] || event,
-          value: value,
-          endpoint: endpoint.to_str
-        }
+      # returns {event => {endpoint => count}}, nil when the monitor isn't counting.
+      def counters
+        return nil unless @counters
+        result = {}
+        @counters.to_h.each do |event, endpoints|
+          result[Events[event] || event] = endpoints
+        end
+        result
+      end
+
+      def close
+        if @counters
+          @counters.stop
+        else
+          @zmq_socket.close
+        end
+        nil
       end
     end
   end
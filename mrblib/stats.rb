@@ -0,0 +1,14 @@
+module ZMQ
+  # only there when the gem was built with MRB_ZMQ_STATS defined
+  if respond_to?(:poller_stats)
+    # {sockets: {socket => Socket#stats}, poller: ZMQ.poller_stats} for every socket which sent or received something
+    def self.stats_all
+      sockets = {}
+      ObjectSpace.each_object(ZMQ::Socket) do |socket|
+        stats = socket.__stats__
+        sockets[socket] = stats if stats
+      end
+      { sockets: sockets, poller: poller_stats }
+    end
+  end
+end
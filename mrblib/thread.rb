@@ -0,0 +1,70 @@
+module ZMQ
+  # runs code in its own mrb_state on a native thread, sharing the libzmq context with this one.
+  # code is the source of a Proc, it gets called with the child end of a Pair pipe and args.
+  # args and the return value are copied between the interpreters with Msg.pack and may only hold plain data,
+  # any other return value becomes nil.
+  #
+  #   thread = ZMQ::Thread.new("lambda {|pipe, n| n * 2}", 21)
+  #   thread.join # => 42
+  class Thread
+    class Error < StandardError; end
+
+    TERM = "$TERM".freeze
+
+    attr_reader :pipe
+
+    def initialize(code, *args)
+      @pipe = Pair.new
+      __start__(@pipe, code.to_str, Msg.pack(args))
+    end
+
+    # waits for the thread to exit and returns the value of its Proc,
+    # raises the exception it died with when its class exists here too, ZMQ::Thread::Error otherwise.
+    def join
+      @result ||= __join__
+      ok, value, message = @result
+      unless ok
+        raise Thread.error_class(value), message
+      end
+      value
+    end
+
+    alias_method :value, :join
+
+    # asks the thread to stop by sending TERM through the pipe, without waiting for it to exit.
+    # Stopping is cooperative, the code running in the thread has to read its pipe and return on TERM,
+    # join waits for that. Returns false when the thread already finished or the pipe couldn't take TERM.
+    def kill
+      alive? ? @pipe.try_send(TERM) : false
+    end
+
+    def self.term?(msg)
+      msg.to_str == TERM
+    end
+
+    def self.error_class(name)
+      klass = name.split("::").inject(Object) {|mod, const| mod.const_get(const)}
+      klass.is_a?(Class) && klass <= Exception ? klass : Error
+    rescue NameError
+      Error
+    end
+
+    # called inside the new mrb_state
+    def self.__run__(endpoint, proc, args)
+      unless proc.respond_to?(:call)
+        raise TypeError, "ZMQ::Thread code must evaluate to a Proc"
+      end
+      pipe = Pair.new(endpoint)
+      begin
+        value = proc.call(pipe, *Msg.new(args).unpack)
+      ensure
+        pipe.close
+      end
+      begin
+        Msg.pack(value)
+      rescue TypeError, ArgumentError
+        nil
+      end
+    end
+  end
+end
@@ -2,56 +2,37 @@ module ZMQ
   class Zap
     attr_reader :zmq_socket
 
+    # handle_zap is implemented in C, it answers allowlisted CURVE keys and PLAIN users
+    # and decisions from its LRU cache of cache_size entries without calling the authenticator.
+    #
+    #   ZMQ::Zap.new(authenticator: auth, allowlist: {curve: {"rq:rM>}U?@Lns47E1%kR.o@n%FcmmsL/@{H8]yf7" => "alice"}, plain: {"bob" => "secret"}})
     def initialize(options = {})
       @authenticator = options.fetch(:authenticator)
       @zmq_socket = ZMQ::Router.new("inproc://zeromq.zap.01")
+      __setup__(options.fetch(:cache_size, 1024))
+      self.allowlist = options[:allowlist] if options[:allowlist]
     end
 
-    def handle_zap
-      socket_identity, _, version, request_id, domain, address, identity, mechanism, *credentials = @zmq_socket.recv
-      if version.to_str == '1.0'
-        user, metadata = @authenticator.authenticate(domain.to_str, address.to_str, identity.to_str, mechanism.to_str, *credentials)
-        if user
-          send_reply(socket_identity, _, version, request_id, 200, 'OK', user, metadata)
-        else
-          send_reply(socket_identity, _, version, request_id, 400, 'Invalid credentials', nil)
-        end
-      else
-        send_reply(socket_identity, _, 1.0, request_id, 500, 'Version number not valid', nil)
-      end
-    rescue => e
-      ZMQ.logger.crash(e)
-      if socket_identity && _ && version && request_id
-        send_reply(socket_identity, _, version, request_id, 300, 'Temporary Error', nil)
+    attr_reader :allowlist
+
+    # replaces the allowlist at runtime, curve is a Array of public keys or a Hash of public key => user id,
+    # plain a Hash of username => password. Public keys can be z85 encoded or binary.
+    def allowlist=(allowlist)
+      curve = {}
+      (allowlist[:curve] || []).each do |key, user|
+        curve[key] = user || key
       end
+      __allowlist__(curve, allowlist[:plain] || {})
+      @allowlist = allowlist
     end
 
-    def send_reply(socket_identity, _, version, request_id, status_code, reason, user, metadata = nil)
-      LibZMQ.msg_send(socket_identity, @zmq_socket, LibZMQ::SNDMORE)
-      LibZMQ.msg_send(_, @zmq_socket, LibZMQ::SNDMORE)
-      if version.is_a?(ZMQ::Msg)
-        LibZMQ.msg_send(version, @zmq_socket, LibZMQ::SNDMORE)
-      else
-        LibZMQ.send(@zmq_socket, version, LibZMQ::SNDMORE)
-      end
-      LibZMQ.msg_send(request_id, @zmq_socket, LibZMQ::SNDMORE)
-      LibZMQ.send(@zmq_socket, status_code, LibZMQ::SNDMORE)
-      LibZMQ.send(@zmq_socket, reason, LibZMQ::SNDMORE)
-      LibZMQ.send(@zmq_socket, user, LibZMQ::SNDMORE)
-      if metadata.respond_to?(:each)
-        meta = ""
-        metadata.each do |key, value|
-          key, value = String(key), String(value)
-          if key.bytesize > 255
-            raise ArgumentError, "metadata keys can only be 8 bit long"
-          else
-            meta << sprintf("%s%s%s%s", [key.bytesize].pack('C'), key, [value.bytesize].pack('N'), value)
-          end
-        end
-        LibZMQ.send(@zmq_socket, meta, 0)
-      else
-        LibZMQ.send(@zmq_socket, nil, 0)
-      end
+    # called by handle_zap when neither the allowlist nor the cache had a answer
+    def __authenticate__(domain, address, identity, mechanism, *credentials)
+      user, metadata = @authenticator.authenticate(domain, address, identity, mechanism, *credentials)
+      user ? [200, user, metadata] : [400]
+    rescue => e
+      ZMQ.logger.crash(e)
+      [300]
     end
 
     class Authenticator
@@ -60,9 +41,9 @@ module ZMQ
         when 'NULL'
           null(domain, address, identity)
         when 'PLAIN'
-          plain(domain, address, identity, credentials.first.to_str, credentials.last.to_str)
+          plain(domain, address, identity, credentials.first, credentials.last)
         when 'CURVE'
-          curve(domain, address, identity, credentials.first.to_str)
+          curve(domain, address, identity, credentials.first)
         else
           raise ArgumentError, "Unknown mechanism #{mechanism.dump}"
         end
@@ -2,6 +2,74 @@
 
 Dir.chdir(File.dirname($0))
 
+# socket options ZMQ::Socket gets native accessors for: name => [type, access, max size of string and binary options]
+# bool getters get a ? appended, see mrb_zmq_sockopt_type_t in mrb_libzmq.h for the types.
+SOCKOPTS = {
+  "affinity"                 => [:uint64, :rw],
+  "backlog"                  => [:int,    :rw],
+  "conflate"                 => [:bool,   :w],
+  "connect_rid"              => [:binary, :w, 255],
+  "connect_routing_id"       => [:binary, :w, 255],
+  "curve_publickey"          => [:binary, :rw, 32],
+  "curve_secretkey"          => [:binary, :rw, 32],
+  "curve_server"             => [:bool,   :w],
+  "curve_serverkey"          => [:binary, :rw, 32],
+  "events"                   => [:int,    :r],
+  "fd"                       => [:fd,     :r],
+  "gssapi_plaintext"         => [:bool,   :rw],
+  "gssapi_principal"         => [:string, :rw, 1024],
+  "gssapi_server"            => [:bool,   :rw],
+  "gssapi_service_principal" => [:string, :rw, 1024],
+  "handshake_ivl"            => [:int,    :rw],
+  "heartbeat_ivl"            => [:int,    :rw],
+  "heartbeat_timeout"        => [:int,    :rw],
+  "heartbeat_ttl"            => [:int,    :rw],
+  "immediate"                => [:bool,   :rw],
+  "ipv6"                     => [:bool,   :rw],
+  "last_endpoint"            => [:string, :r, 1024],
+  "linger"                   => [:int,    :rw],
+  "maxmsgsize"               => [:int64,  :rw],
+  "mechanism"                => [:int,    :r],
+  "multicast_hops"           => [:int,    :rw],
+  "plain_password"           => [:string, :rw, 256],
+  "plain_server"             => [:bool,   :rw],
+  "plain_username"           => [:string, :rw, 256],
+  "probe_router"             => [:bool,   :w],
+  "rate"                     => [:int,    :rw],
+  "rcvhwm"                   => [:int,    :rw],
+  "rcvmore"                  => [:bool,   :r],
+  "rcvtimeo"                 => [:int,    :rw],
+  "reconnect_ivl"            => [:int,    :rw],
+  "reconnect_ivl_max"        => [:int,    :rw],
+  "recovery_ivl"             => [:int,    :rw],
+  "req_correlate"            => [:bool,   :w],
+  "req_relaxed"              => [:bool,   :w],
+  "router_handover"          => [:bool,   :w],
+  "router_mandatory"         => [:bool,   :w],
+  "routing_id"               => [:binary, :rw, 255],
+  "sndbuf"                   => [:int,    :rw],
+  "sndhwm"                   => [:int,    :rw],
+  "sndtimeo"                 => [:int,    :rw],
+  "tcp_keepalive"            => [:int,    :rw],
+  "tcp_keepalive_cnt"        => [:int,    :rw],
+  "tcp_keepalive_idle"       => [:int,    :rw],
+  "tcp_keepalive_intvl"      => [:int,    :rw],
+  "tos"                      => [:int,    :rw],
+  "use_fd"                   => [:int,    :w],
+  "xpub_verbose"             => [:bool,   :w],
+  "zap_domain"               => [:string, :rw, 256]
+}
+
+File.open("zmq_sockopt.cstub", "w") do |d|
+  SOCKOPTS.each do |name, (type, access, max_size)|
+    d.write <<-C
+#ifdef ZMQ_#{name.upcase}
+{"#{name}", ZMQ_#{name.upcase}, MRB_ZMQ_SOCKOPT_#{type.upcase}, #{max_size || 0}, MRB_ZMQ_SOCKOPT_#{access.upcase}},
+#endif
+C
+  end
+end
+
 d = File.open("zmq_const.cstub", "w")
 
 define_match = /^[ \t]*#define ZMQ_(\S+)[ \t]*((?:.*\\\r?\n)*.*)/m
@@ -1,5 +1,326 @@
 #include "mrb_libzmq.h"
 
+static void
+mrb_zmq_msg_pool_trim(mrb_state *mrb, mrb_zmq_msg_pool_t *pool, mrb_int max)
+{
+  while (pool->size > max) {
+    mrb_zmq_msg_slot_t *slot = pool->free_list;
+    pool->free_list = slot->u.next;
+    pool->size--;
+    mrb_free(mrb, slot);
+  }
+}
+
+static void
+mrb_zmq_msg_pool_close(mrb_state *mrb, mrb_zmq_msg_pool_t *pool)
+{
+  mrb_zmq_msg_pool_trim(mrb, pool, 0);
+  pool->closed = TRUE;
+  if (pool->live == 0) {
+    mrb_free(mrb, pool);
+  }
+}
+
+// returns a uninitialized zmq_msg_t
+static zmq_msg_t *
+mrb_zmq_msg_pool_take(mrb_state *mrb, mrb_zmq_msg_pool_t *pool)
+{
+  mrb_zmq_msg_slot_t *slot = pool->free_list;
+  if (likely(slot)) {
+    pool->free_list = slot->u.next;
+    pool->size--;
+    pool->hits++;
+  } else {
+    slot = (mrb_zmq_msg_slot_t *) mrb_malloc(mrb, sizeof(*slot));
+    slot->pool = pool;
+    pool->misses++;
+  }
+  slot->bytes = 0;
+  pool->live++;
+
+  return &slot->u.msg;
+}
+
+// takes a closed zmq_msg_t back
+static void
+mrb_zmq_msg_pool_return(mrb_state *mrb, zmq_msg_t *msg)
+{
+  mrb_zmq_msg_slot_t *slot = mrb_zmq_msg_slot(msg);
+  mrb_zmq_msg_pool_t *pool = slot->pool;
+  pool->live--;
+  pool->live_bytes -= slot->bytes;
+
+  if (unlikely(pool->closed)) {
+    mrb_free(mrb, slot);
+    if (pool->live == 0) {
+      mrb_free(mrb, pool);
+    }
+  } else if (pool->size < pool->max) {
+    slot->u.next = pool->free_list;
+    pool->free_list = slot;
+    pool->size++;
+  } else {
+    pool->drops++;
+    mrb_free(mrb, slot);
+  }
+}
+
+// brings the payload size accounted for msg up to date, call it whenever a ZMQ::Msg got a new payload.
+// Must not be called while the GC sweeps.
+static void
+mrb_zmq_msg_account(mrb_state *mrb, zmq_msg_t *msg)
+{
+  mrb_zmq_msg_slot_t *slot = mrb_zmq_msg_slot(msg);
+  mrb_zmq_msg_pool_t *pool = slot->pool;
+  size_t bytes = zmq_msg_size(msg);
+
+  pool->live_bytes = pool->live_bytes - slot->bytes + bytes;
+  slot->bytes = bytes;
+
+  // payloads released with Msg#close! lower the baseline, so they never add pressure.
+  if (pool->live_bytes < pool->baseline) {
+    pool->baseline = pool->live_bytes;
+  } else if (unlikely(pool->pressure_limit && pool->live_bytes - pool->baseline >= pool->pressure_limit)) {
+    mrb_full_gc(mrb);
+    pool->baseline = pool->live_bytes;
+  }
+}
+
+// for a msg which only took another reference on the payload of a accounted msg with zmq_msg_copy,
+// the payload stays counted once for the msg it came from.
+static void
+mrb_zmq_msg_account_shared(zmq_msg_t *msg)
+{
+  mrb_zmq_msg_slot_t *slot = mrb_zmq_msg_slot(msg);
+  slot->pool->live_bytes -= slot->bytes;
+  slot->bytes = 0;
+}
+
+static void
+mrb_zmq_zero_copy_free(void *data, void *hint_)
+{
+  mrb_zmq_zero_copy_hint_t *hint = (mrb_zmq_zero_copy_hint_t *) hint_;
+  mrb_zmq_reaper_t *reaper = hint->reaper;
+  {
+    std::lock_guard<std::mutex> lock(reaper->mutex);
+    reaper->released.push_back(hint->token);
+    reaper->pending.store(true, std::memory_order_release);
+  }
+  free(hint);
+  mrb_zmq_reaper_unref(reaper);
+}
+
+// unpins Strings whose zero copy msgs libzmq has released, must be called on the mruby thread.
+static void
+mrb_zmq_reap_zero_copy(mrb_state *mrb, mrb_zmq_state_t *state)
+{
+  if (likely(!state->reaper->pending.load(std::memory_order_acquire))) {
+    return;
+  }
+
+  std::vector<mrb_int> released;
+  {
+    std::lock_guard<std::mutex> lock(state->reaper->mutex);
+    released.swap(state->reaper->released);
+    state->reaper->pending.store(false, std::memory_order_relaxed);
+  }
+
+  for (mrb_int token : released) {
+    mrb_hash_delete_key(mrb, state->pins, mrb_int_value(mrb, token));
+  }
+}
+
+// every new ZMQ::Msg also unpins what libzmq released meanwhile, so pins don't wait for the next zero copy msg.
+MRB_INLINE zmq_msg_t *
+mrb_zmq_msg_alloc(mrb_state *mrb)
+{
+  mrb_zmq_state_t *state = mrb_zmq_get_state(mrb);
+  mrb_zmq_reap_zero_copy(mrb, state);
+  return mrb_zmq_msg_pool_take(mrb, state->msg_pool);
+}
+
+static mrb_zmq_state_t *
+mrb_zmq_state_init(mrb_state *mrb)
+{
+  mrb_zmq_state_t *state = (mrb_zmq_state_t *) mrb_calloc(mrb, 1, sizeof(*state));
+  state->msg_pool = (mrb_zmq_msg_pool_t *) mrb_calloc(mrb, 1, sizeof(*state->msg_pool));
+  state->msg_pool->max = MRB_ZMQ_MSG_POOL_MAX;
+  if (getenv("ZMQ_MSG_POOL_MAX")) {
+    state->msg_pool->max = atoi(getenv("ZMQ_MSG_POOL_MAX"));
+  }
+  state->msg_pool->pressure_limit = MRB_ZMQ_GC_PRESSURE_BYTES;
+  if (getenv("ZMQ_GC_PRESSURE_BYTES")) {
+    state->msg_pool->pressure_limit = strtoull(getenv("ZMQ_GC_PRESSURE_BYTES"), NULL, 10);
+  }
+  state->reaper = new mrb_zmq_reaper_t();
+  state->reaper->pending = false;
+  state->reaper->refcount = 1;
+  mrb_value state_val = mrb_obj_value(mrb_data_object_alloc(mrb, mrb->object_class, state, &mrb_zmq_state_type));
+  state->pins = mrb_hash_new(mrb);
+  mrb_iv_set(mrb, state_val, MRB_SYM(pins), state->pins);
+  state->contexts = mrb_hash_new(mrb);
+  mrb_iv_set(mrb, state_val, MRB_SYM(contexts), state->contexts);
+  state->proxies = mrb_hash_new(mrb);
+  mrb_iv_set(mrb, state_val, MRB_SYM(proxies), state->proxies);
+  state->monitor_counters = mrb_hash_new(mrb);
+  mrb_iv_set(mrb, state_val, MRB_SYM(monitor_counters), state->monitor_counters);
+  state->loggers = mrb_hash_new(mrb);
+  mrb_iv_set(mrb, state_val, MRB_SYM(loggers), state->loggers);
+  state->threads = mrb_hash_new(mrb);
+  mrb_iv_set(mrb, state_val, MRB_SYM(threads), state->threads);
+  mrb_gv_set(mrb, MRB_SYM(__mrb_zmq_state__), state_val);
+
+  return state;
+}
+
+static void
+mrb_zmq_context_shutdown_close_and_term(mrb_state *mrb, mrb_value context_val)
+{
+  void *context_ = DATA_PTR(context_val);
+  if (!context_) {
+    return;
+  }
+
+  mrb_zmq_state_t *state = mrb_zmq_get_state(mrb);
+  zmq_ctx_shutdown(context_);
+  mrb_zmq_close_sockets_t close_sockets = { state->zmq_socket_class, context_val };
+  mrb_objspace_each_objects(mrb, mrb_zmq_zmq_close_gem_final, &close_sockets);
+  zmq_ctx_term(context_);
+  mrb_data_init(context_val, NULL, &mrb_zmq_context_type);
+  mrb_hash_delete_key(mrb, state->contexts, mrb_zmq_ptr_key(mrb, context_));
+}
+
+#ifdef MRB_ZMQ_STATS
+MRB_INLINE uint64_t
+mrb_zmq_stats_now()
+{
+  return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+MRB_INLINE int
+mrb_zmq_histogram_bucket(uint64_t value)
+{
+  if (value < (1 << MRB_ZMQ_HISTOGRAM_SUB_BITS)) {
+    return (int) value;
+  }
+#if defined(__GNUC__)
+  int exponent = 63 - __builtin_clzll(value);
+#else
+  int exponent = 0;
+  for (uint64_t v = value; v >>= 1;) {
+    exponent++;
+  }
+#endif
+  int sub = (int) (value >> (exponent - MRB_ZMQ_HISTOGRAM_SUB_BITS)) & ((1 << MRB_ZMQ_HISTOGRAM_SUB_BITS) - 1);
+  return ((exponent - MRB_ZMQ_HISTOGRAM_SUB_BITS + 1) << MRB_ZMQ_HISTOGRAM_SUB_BITS) + sub;
+}
+
+// the smallest value which lands in bucket
+MRB_INLINE uint64_t
+mrb_zmq_histogram_bucket_value(int bucket)
+{
+  if (bucket < (1 << MRB_ZMQ_HISTOGRAM_SUB_BITS)) {
+    return (uint64_t) bucket;
+  }
+  int exponent = (bucket >> MRB_ZMQ_HISTOGRAM_SUB_BITS) + MRB_ZMQ_HISTOGRAM_SUB_BITS - 1;
+  uint64_t sub = (uint64_t) (bucket & ((1 << MRB_ZMQ_HISTOGRAM_SUB_BITS) - 1));
+  return ((1ULL << MRB_ZMQ_HISTOGRAM_SUB_BITS) | sub) << (exponent - MRB_ZMQ_HISTOGRAM_SUB_BITS);
+}
+
+MRB_INLINE void
+mrb_zmq_histogram_record(mrb_zmq_histogram_t *histogram, uint64_t value)
+{
+  if (histogram->count == 0 || value < histogram->min) {
+    histogram->min = value;
+  }
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+  histogram->count++;
+  histogram->sum += value;
+  histogram->buckets[mrb_zmq_histogram_bucket(value)]++;
+}
+
+static mrb_zmq_socket_stats_t *
+mrb_zmq_socket_stats(mrb_state *mrb, mrb_value socket_val)
+{
+  mrb_value stats_val = mrb_iv_get(mrb, socket_val, MRB_SYM(stats));
+  if (likely(mrb_data_p(stats_val))) {
+    return (mrb_zmq_socket_stats_t *) DATA_PTR(stats_val);
+  }
+  mrb_zmq_socket_stats_t *stats = (mrb_zmq_socket_stats_t *) mrb_calloc(mrb, 1, sizeof(*stats));
+  mrb_iv_set(mrb, socket_val, MRB_SYM(stats), mrb_obj_value(mrb_data_object_alloc(mrb, mrb->object_class, stats, &mrb_zmq_socket_stats_type)));
+  return stats;
+}
+
+static void
+mrb_zmq_stats_error(mrb_zmq_socket_stats_t *stats)
+{
+  switch (mrb_zmq_errno()) {
+    case EAGAIN: stats->eagain++; break;
+    case ETERM:  stats->eterm++;  break;
+    default:     stats->errors++;
+  }
+}
+
+static void
+mrb_zmq_stats_sent(mrb_state *mrb, mrb_value socket_val, int rc, size_t bytes)
+{
+  mrb_zmq_socket_stats_t *stats = mrb_zmq_socket_stats(mrb, socket_val);
+  if (rc == -1) {
+    mrb_zmq_stats_error(stats);
+  } else {
+    stats->msgs_out++;
+    stats->bytes_out += bytes;
+  }
+}
+
+// msgs is how many whole messages were received, 0 for a part which isn't the last one
+static void
+mrb_zmq_stats_received_bytes(mrb_state *mrb, mrb_value socket_val, int rc, int msgs, size_t bytes, uint64_t started)
+{
+  uint64_t waited = mrb_zmq_stats_now() - started;
+  mrb_zmq_socket_stats_t *stats = mrb_zmq_socket_stats(mrb, socket_val);
+  if (rc == -1) {
+    mrb_zmq_stats_error(stats);
+    return;
+  }
+  mrb_zmq_histogram_record(&stats->recv_wait, waited);
+  stats->msgs_in += msgs;
+  stats->bytes_in += bytes;
+}
+
+// data is what mrb_zmq_recv_message returned, a ZMQ::Msg or a Array of them
+static void
+mrb_zmq_stats_received(mrb_state *mrb, mrb_value socket_val, int rc, mrb_value data, uint64_t started)
+{
+  size_t bytes = 0;
+  if (rc != -1) {
+    if (mrb_array_p(data)) {
+      for (mrb_int i = 0; i < RARRAY_LEN(data); i++) {
+        bytes += zmq_msg_size((zmq_msg_t *) DATA_PTR(RARRAY_PTR(data)[i]));
+      }
+    } else {
+      bytes = zmq_msg_size((zmq_msg_t *) DATA_PTR(data));
+    }
+  }
+  mrb_zmq_stats_received_bytes(mrb, socket_val, rc, 1, bytes, started);
+}
+
+#define MRB_ZMQ_STATS_CLOCK(started) uint64_t started = mrb_zmq_stats_now()
+#define MRB_ZMQ_STATS_SENT(mrb, socket_val, rc, bytes) mrb_zmq_stats_sent(mrb, socket_val, rc, bytes)
+#define MRB_ZMQ_STATS_RECEIVED(mrb, socket_val, rc, data, started) mrb_zmq_stats_received(mrb, socket_val, rc, data, started)
+#define MRB_ZMQ_STATS_RECEIVED_BYTES(mrb, socket_val, rc, msgs, bytes, started) mrb_zmq_stats_received_bytes(mrb, socket_val, rc, msgs, bytes, started)
+#define MRB_ZMQ_STATS_POLLED(mrb, started) mrb_zmq_histogram_record(&mrb_zmq_get_state(mrb)->poll_wait, mrb_zmq_stats_now() - (started))
+#else
+#define MRB_ZMQ_STATS_CLOCK(started)
+// byte counts are only summed up for the stats, this keeps them from being unused
+#define MRB_ZMQ_STATS_SENT(mrb, socket_val, rc, bytes) ((void) (bytes))
+#define MRB_ZMQ_STATS_RECEIVED(mrb, socket_val, rc, data, started)
+#define MRB_ZMQ_STATS_RECEIVED_BYTES(mrb, socket_val, rc, msgs, bytes, started) ((void) (bytes))
+#define MRB_ZMQ_STATS_POLLED(mrb, started)
+#endif
+
 static mrb_value
 mrb_zmq_bind(mrb_state *mrb, mrb_value self)
 {
@@ -94,6 +415,72 @@ mrb_zmq_ctx_set(mrb_state *mrb, mrb_value self)
   return self;
 }
 
+static mrb_value
+mrb_zmq_context_new(mrb_state *mrb, mrb_value self)
+{
+  if (unlikely(DATA_PTR(self))) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Context instance already initialized");
+  }
+
+  mrb_value options = mrb_nil_value();
+  mrb_get_args(mrb, "|H", &options);
+
+  void *context = zmq_ctx_new();
+  if (unlikely(!context)) {
+    mrb_zmq_handle_error(mrb, "zmq_ctx_new");
+  }
+  mrb_data_init(self, context, &mrb_zmq_context_type);
+  mrb_hash_set(mrb, mrb_zmq_get_state(mrb)->contexts, mrb_zmq_ptr_key(mrb, context), self);
+  if (!mrb_nil_p(options)) {
+    mrb_funcall_id(mrb, self, MRB_SYM(setopts), 1, options);
+  }
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_context_get(mrb_state *mrb, mrb_value self)
+{
+  mrb_int option_name;
+  mrb_get_args(mrb, "i", &option_name);
+
+  int rc = zmq_ctx_get(DATA_PTR(self), (int) option_name);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_ctx_get");
+  }
+
+  return mrb_convert_number(mrb, rc);
+}
+
+static mrb_value
+mrb_zmq_context_set(mrb_state *mrb, mrb_value self)
+{
+  mrb_int option_name, option_value;
+  mrb_get_args(mrb, "ii", &option_name, &option_value);
+
+  int rc = zmq_ctx_set(DATA_PTR(self), (int) option_name, (int) option_value);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_ctx_set");
+  }
+
+  return self;
+}
+
+// closes every socket created with this context, then terminates it.
+static mrb_value
+mrb_zmq_context_close(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_context_shutdown_close_and_term(mrb, self);
+
+  return mrb_nil_value();
+}
+
+static mrb_value
+mrb_zmq_context_closed(mrb_state *mrb, mrb_value self)
+{
+  return mrb_bool_value(DATA_PTR(self) == NULL);
+}
+
 static mrb_value
 mrb_zmq_curve_keypair(mrb_state *mrb, mrb_value self)
 {
@@ -204,13 +591,23 @@ mrb_zmq_msg_new(mrb_state *mrb, mrb_value self)
   mrb_value data = mrb_nil_value();
   mrb_get_args(mrb, "|o", &data);
 
-  zmq_msg_t *msg = (zmq_msg_t *) mrb_realloc(mrb, DATA_PTR(self), sizeof(*msg));
-  mrb_data_init(self, msg, &mrb_zmq_msg_type);
+  zmq_msg_t *msg = (zmq_msg_t *) DATA_PTR(self);
+  if (msg) {
+    zmq_msg_close(msg);
+    mrb_iv_remove(mrb, self, MRB_SYM(view));
+  } else {
+    msg = mrb_zmq_msg_alloc(mrb);
+    mrb_data_init(self, msg, &mrb_zmq_msg_type);
+  }
 
   switch (mrb_type(data)) {
     case MRB_TT_STRING: {
       int rc = zmq_msg_init_size(msg, RSTRING_LEN(data));
       if (unlikely(-1 == rc)) {
+        int err = mrb_zmq_errno();
+        zmq_msg_init(msg);
+        mrb_zmq_msg_account(mrb, msg);
+        errno = err;
         mrb_zmq_handle_error(mrb, "zmq_msg_init_size");
       }
       memcpy(zmq_msg_data(msg), RSTRING_PTR(data), RSTRING_LEN(data));
@@ -219,384 +616,2730 @@ mrb_zmq_msg_new(mrb_state *mrb, mrb_value self)
       zmq_msg_init(msg);
     } break;
     default: {
+      zmq_msg_init(msg);
+      mrb_zmq_msg_account(mrb, msg);
       mrb_raise(mrb, E_TYPE_ERROR, "(optionally) expected a String");
     }
   }
+  mrb_zmq_msg_account(mrb, msg);
 
   return self;
 }
 
-static mrb_value
-mrb_zmq_msg_copy(mrb_state *mrb, mrb_value copy)
+// hands the buffer of a String to libzmq without copying it,
+// the String gets frozen and stays pinned until libzmq releases the msg. Strings which get copied stay untouched.
+static void
+mrb_zmq_msg_init_zero_copy(mrb_state *mrb, zmq_msg_t *msg, mrb_value str)
 {
-  zmq_msg_t* msg_src;
-  mrb_get_args(mrb, "d", &msg_src, &mrb_zmq_msg_type);
-  if (msg_src && msg_src == DATA_PTR(copy)) return copy;
+  // with a foreign context a msg can outlive this mrb_state and with it the String, so it gets copied then.
+  mrb_zmq_state_t *state = mrb_zmq_get_state(mrb);
+  if (RSTRING_LEN(str) < MRB_ZMQ_ZERO_COPY_MIN_SIZE || state->foreign_context) {
+    int rc = zmq_msg_init_size(msg, RSTRING_LEN(str));
+    if (unlikely(-1 == rc)) {
+      mrb_zmq_handle_error(mrb, "zmq_msg_init_size");
+    }
+    memcpy(zmq_msg_data(msg), RSTRING_PTR(str), RSTRING_LEN(str));
+    return;
+  }
 
-  if (unlikely(!msg_src)) {
-    mrb_raise(mrb, E_ARGUMENT_ERROR, "uninitialized src msg");
+  mrb_zmq_reap_zero_copy(mrb, state);
+
+  MRB_SET_FROZEN_FLAG(mrb_basic_ptr(str));
+  mrb_value token = mrb_int_value(mrb, ++state->pin_seq);
+  mrb_hash_set(mrb, state->pins, token, str);
+  mrb_zmq_zero_copy_hint_t *hint = (mrb_zmq_zero_copy_hint_t *) malloc(sizeof(*hint));
+  if (unlikely(!hint)) {
+    mrb_hash_delete_key(mrb, state->pins, token);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
   }
+  hint->reaper = state->reaper;
+  hint->token = state->pin_seq;
+  state->reaper->refcount.fetch_add(1, std::memory_order_relaxed);
 
-  zmq_msg_t *msg_copy = (zmq_msg_t *) mrb_realloc(mrb, DATA_PTR(copy), sizeof(*msg_copy));
-  mrb_data_init(copy, msg_copy, &mrb_zmq_msg_type);
-  zmq_msg_init(msg_copy);
-  int rc = zmq_msg_copy(msg_copy, msg_src);
+  int rc = zmq_msg_init_data(msg, RSTRING_PTR(str), RSTRING_LEN(str), mrb_zmq_zero_copy_free, hint);
   if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_msg_copy");
+    int err = mrb_zmq_errno();
+    state->reaper->refcount.fetch_sub(1, std::memory_order_relaxed);
+    free(hint);
+    mrb_hash_delete_key(mrb, state->pins, token);
+    errno = err;
+    mrb_zmq_handle_error(mrb, "zmq_msg_init_data");
   }
-  return copy;
 }
 
 static mrb_value
-mrb_zmq_msg_gets(mrb_state *mrb, mrb_value self)
+mrb_zmq_msg_wrap(mrb_state *mrb, mrb_value self)
 {
-  zmq_msg_t *msg;
-  char *property;
-  mrb_get_args(mrb, "dz", &msg, &mrb_zmq_msg_type, &property);
+  mrb_value data;
+  mrb_get_args(mrb, "S", &data);
 
-  const char *prop = zmq_msg_gets(msg, property);
-  if (prop) {
-    return mrb_str_new_cstr(mrb, prop);
-  } else {
-    return mrb_nil_value();
-  }
+  mrb_value msg_val = mrb_obj_value(mrb_data_object_alloc(mrb, mrb_class_ptr(self), NULL, NULL));
+  zmq_msg_t *msg = mrb_zmq_msg_alloc(mrb);
+  zmq_msg_init(msg);
+  mrb_data_init(msg_val, msg, &mrb_zmq_msg_type);
+
+  zmq_msg_t wrapped;
+  mrb_zmq_msg_init_zero_copy(mrb, &wrapped, data);
+  zmq_msg_move(msg, &wrapped);
+  mrb_zmq_msg_account(mrb, msg);
+
+  return msg_val;
 }
 
-static mrb_value
-mrb_zmq_msg_send(mrb_state *mrb, mrb_value self)
+// Msg.pack / Msg#unpack format, every value starts with a tag byte.
+// Integers are zigzag varints, Floats 8 byte little endian doubles,
+// Strings and Symbols a varint length followed by their bytes,
+// Arrays and Hashes a varint count followed by their elements.
+enum {
+  MRB_ZMQ_PACK_NIL,
+  MRB_ZMQ_PACK_FALSE,
+  MRB_ZMQ_PACK_TRUE,
+  MRB_ZMQ_PACK_INTEGER,
+  MRB_ZMQ_PACK_FLOAT,
+  MRB_ZMQ_PACK_STRING,
+  MRB_ZMQ_PACK_SYMBOL,
+  MRB_ZMQ_PACK_ARRAY,
+  MRB_ZMQ_PACK_HASH
+};
+
+MRB_INLINE uint64_t
+mrb_zmq_zigzag(mrb_int value)
 {
-  zmq_msg_t *msg;
-  void *socket;
-  mrb_int flags;
-  mrb_get_args(mrb, "ddi", &msg, &mrb_zmq_msg_type, &socket, &mrb_zmq_socket_type, &flags);
-  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+  int64_t v = (int64_t) value;
+  return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
 
-  int rc = zmq_msg_send(msg, socket, flags);
-  if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_msg_send");
+MRB_INLINE size_t
+mrb_zmq_varint_size(uint64_t value)
+{
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
   }
-
-  return mrb_nil_value();
+  return size;
 }
 
-static mrb_value
-mrb_zmq_msg_size(mrb_state *mrb, mrb_value self)
+MRB_INLINE uint8_t *
+mrb_zmq_varint_write(uint8_t *p, uint64_t value)
 {
-  zmq_msg_t *msg;
-  mrb_get_args(mrb, "d", &msg, &mrb_zmq_msg_type);
-
-  return mrb_convert_number(mrb, zmq_msg_size(msg));
+  while (value >= 0x80) {
+    *p++ = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (uint8_t) value;
+  return p;
 }
 
-static mrb_value
-mrb_zmq_proxy(mrb_state *mrb, mrb_value self)
-{
-  void *frontend, *backend, *capture = NULL;
-  mrb_get_args(mrb, "dd|d!", &frontend, &mrb_zmq_socket_type, &backend, &mrb_zmq_socket_type, &capture, &mrb_zmq_socket_type);
+static size_t mrb_zmq_pack_size(mrb_state *mrb, mrb_value obj, int depth);
+static uint8_t *mrb_zmq_pack_write(mrb_state *mrb, uint8_t *p, mrb_value obj);
 
-  int rc = zmq_proxy(frontend, backend, capture);
-  if (-1 == rc) {
-    mrb_zmq_handle_error(mrb, "zmq_proxy");
-  }
+typedef struct {
+  size_t size;
+  int depth;
+} mrb_zmq_pack_size_t;
 
-  return self;
+static int
+mrb_zmq_pack_size_pair(mrb_state *mrb, mrb_value key, mrb_value value, void *data)
+{
+  mrb_zmq_pack_size_t *pack_size = (mrb_zmq_pack_size_t *) data;
+  pack_size->size += mrb_zmq_pack_size(mrb, key, pack_size->depth);
+  pack_size->size += mrb_zmq_pack_size(mrb, value, pack_size->depth);
+  return 0;
 }
 
-static mrb_value
-mrb_zmq_proxy_steerable(mrb_state *mrb, mrb_value self)
+// the exact number of bytes mrb_zmq_pack_write needs for obj, raises for anything it can't pack.
+static size_t
+mrb_zmq_pack_size(mrb_state *mrb, mrb_value obj, int depth)
 {
-  void *frontend, *backend, *control, *capture = NULL;
-  mrb_get_args(mrb, "ddd|d!", &frontend, &mrb_zmq_socket_type, &backend, &mrb_zmq_socket_type, &control, &mrb_zmq_socket_type,
-    &capture, &mrb_zmq_socket_type);
+  if (unlikely(depth > MRB_ZMQ_PACK_MAX_DEPTH)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "too deeply nested to pack");
+  }
 
-  int rc = zmq_proxy_steerable(frontend, backend, capture, control);
-  if (-1 == rc) {
-    mrb_zmq_handle_error(mrb, "zmq_proxy");
+  switch (mrb_type(obj)) {
+    case MRB_TT_FALSE:
+    case MRB_TT_TRUE:
+      return 1;
+    case MRB_TT_INTEGER:
+      return 1 + mrb_zmq_varint_size(mrb_zmq_zigzag(mrb_integer(obj)));
+#ifndef MRB_NO_FLOAT
+    case MRB_TT_FLOAT:
+      return 1 + 8;
+#endif
+    case MRB_TT_STRING:
+      return 1 + mrb_zmq_varint_size(RSTRING_LEN(obj)) + RSTRING_LEN(obj);
+    case MRB_TT_SYMBOL: {
+      mrb_int len;
+      mrb_sym_name_len(mrb, mrb_symbol(obj), &len);
+      return 1 + mrb_zmq_varint_size(len) + len;
+    }
+    case MRB_TT_ARRAY: {
+      size_t size = 1 + mrb_zmq_varint_size(RARRAY_LEN(obj));
+      for (mrb_int i = 0; i < RARRAY_LEN(obj); i++) {
+        size += mrb_zmq_pack_size(mrb, RARRAY_PTR(obj)[i], depth + 1);
+      }
+      return size;
+    }
+    case MRB_TT_HASH: {
+      mrb_zmq_pack_size_t pack_size = { 1 + mrb_zmq_varint_size(mrb_hash_size(mrb, obj)), depth + 1 };
+      mrb_hash_foreach(mrb, mrb_hash_ptr(obj), mrb_zmq_pack_size_pair, &pack_size);
+      return pack_size.size;
+    }
+    default:
+      mrb_raisef(mrb, E_TYPE_ERROR, "cannot pack a %S", mrb_str_new_cstr(mrb, mrb_obj_classname(mrb, obj)));
   }
 
-  return self;
+  return 0;
 }
 
-static mrb_value
-mrb_zmq_msg_to_str(mrb_state *mrb, mrb_value self)
+static int
+mrb_zmq_pack_write_pair(mrb_state *mrb, mrb_value key, mrb_value value, void *data)
 {
-  zmq_msg_t *msg_ = (zmq_msg_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_msg_type);
-  return mrb_str_new(mrb, (const char *) zmq_msg_data(msg_), zmq_msg_size(msg_));
+  uint8_t **p = (uint8_t **) data;
+  *p = mrb_zmq_pack_write(mrb, *p, key);
+  *p = mrb_zmq_pack_write(mrb, *p, value);
+  return 0;
 }
 
-static mrb_value
-mrb_zmq_msg_eql(mrb_state *mrb, mrb_value self)
+// only called after mrb_zmq_pack_size has checked and measured obj.
+static uint8_t *
+mrb_zmq_pack_write(mrb_state *mrb, uint8_t *p, mrb_value obj)
 {
-  zmq_msg_t *other;
-  mrb_get_args(mrb, "d", &other, &mrb_zmq_msg_type);
-
-  zmq_msg_t *msg = (zmq_msg_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_msg_type);
-
-  if (msg == other) {
-    return mrb_true_value();
-  } else if (zmq_msg_size(msg) != zmq_msg_size(other)) {
-    return mrb_false_value();
-  } else {
-    return mrb_bool_value(memcmp(zmq_msg_data(msg), zmq_msg_data(other), zmq_msg_size(msg)) == 0);
+  switch (mrb_type(obj)) {
+    case MRB_TT_FALSE:
+      *p++ = mrb_nil_p(obj) ? MRB_ZMQ_PACK_NIL : MRB_ZMQ_PACK_FALSE;
+      break;
+    case MRB_TT_TRUE:
+      *p++ = MRB_ZMQ_PACK_TRUE;
+      break;
+    case MRB_TT_INTEGER:
+      *p++ = MRB_ZMQ_PACK_INTEGER;
+      p = mrb_zmq_varint_write(p, mrb_zmq_zigzag(mrb_integer(obj)));
+      break;
+#ifndef MRB_NO_FLOAT
+    case MRB_TT_FLOAT: {
+      double value = (double) mrb_float(obj);
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      *p++ = MRB_ZMQ_PACK_FLOAT;
+      for (int i = 0; i < 8; i++) {
+        *p++ = (uint8_t) (bits >> (i * 8));
+      }
+    } break;
+#endif
+    case MRB_TT_STRING:
+      *p++ = MRB_ZMQ_PACK_STRING;
+      p = mrb_zmq_varint_write(p, RSTRING_LEN(obj));
+      memcpy(p, RSTRING_PTR(obj), RSTRING_LEN(obj));
+      p += RSTRING_LEN(obj);
+      break;
+    case MRB_TT_SYMBOL: {
+      mrb_int len;
+      const char *name = mrb_sym_name_len(mrb, mrb_symbol(obj), &len);
+      *p++ = MRB_ZMQ_PACK_SYMBOL;
+      p = mrb_zmq_varint_write(p, len);
+      memcpy(p, name, len);
+      p += len;
+    } break;
+    case MRB_TT_ARRAY:
+      *p++ = MRB_ZMQ_PACK_ARRAY;
+      p = mrb_zmq_varint_write(p, RARRAY_LEN(obj));
+      for (mrb_int i = 0; i < RARRAY_LEN(obj); i++) {
+        p = mrb_zmq_pack_write(mrb, p, RARRAY_PTR(obj)[i]);
+      }
+      break;
+    case MRB_TT_HASH:
+      *p++ = MRB_ZMQ_PACK_HASH;
+      p = mrb_zmq_varint_write(p, mrb_hash_size(mrb, obj));
+      mrb_hash_foreach(mrb, mrb_hash_ptr(obj), mrb_zmq_pack_write_pair, &p);
+      break;
+    default:
+      break;
   }
+
+  return p;
 }
 
 static mrb_value
-mrb_zmq_send(mrb_state *mrb, mrb_value self)
+mrb_zmq_msg_pack(mrb_state *mrb, mrb_value self)
 {
-  void *socket;
-  mrb_value message;
-  mrb_int flags;
-  mrb_get_args(mrb, "doi", &socket, &mrb_zmq_socket_type, &message, &flags);
-  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+  mrb_value obj;
+  mrb_get_args(mrb, "o", &obj);
 
-  message = mrb_str_to_str(mrb, message);
+  size_t size = mrb_zmq_pack_size(mrb, obj, 0);
 
-  int rc = zmq_send(socket, RSTRING_PTR(message), RSTRING_LEN(message), flags);
+  mrb_value msg_val = mrb_obj_value(mrb_data_object_alloc(mrb, mrb_class_ptr(self), NULL, NULL));
+  zmq_msg_t *msg = mrb_zmq_msg_alloc(mrb);
+  mrb_data_init(msg_val, msg, &mrb_zmq_msg_type);
+  int rc = zmq_msg_init_size(msg, size);
   if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_send");
+    int err = mrb_zmq_errno();
+    zmq_msg_init(msg);
+    errno = err;
+    mrb_zmq_handle_error(mrb, "zmq_msg_init_size");
   }
+  mrb_zmq_pack_write(mrb, (uint8_t *) zmq_msg_data(msg), obj);
+  mrb_zmq_msg_account(mrb, msg);
 
-  return mrb_convert_number(mrb, rc);
+  return msg_val;
+}
+
+typedef struct {
+  const uint8_t *p;
+  const uint8_t *end;
+} mrb_zmq_unpack_t;
+
+MRB_INLINE void
+mrb_zmq_unpack_malformed(mrb_state *mrb)
+{
+  mrb_raise(mrb, E_ARGUMENT_ERROR, "malformed packed msg");
+}
+
+static uint64_t
+mrb_zmq_unpack_varint(mrb_state *mrb, mrb_zmq_unpack_t *in)
+{
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (unlikely(in->p >= in->end)) {
+      break;
+    }
+    uint8_t byte = *in->p++;
+    value |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  mrb_zmq_unpack_malformed(mrb);
+  return 0;
+}
+
+// a length or count, which can't be larger than what is left in the msg.
+MRB_INLINE size_t
+mrb_zmq_unpack_len(mrb_state *mrb, mrb_zmq_unpack_t *in)
+{
+  uint64_t len = mrb_zmq_unpack_varint(mrb, in);
+  if (unlikely(len > (uint64_t) (in->end - in->p))) {
+    mrb_zmq_unpack_malformed(mrb);
+  }
+  return (size_t) len;
 }
 
 static mrb_value
-mrb_zmq_setsockopt(mrb_state *mrb, mrb_value self)
+mrb_zmq_unpack_value(mrb_state *mrb, mrb_zmq_unpack_t *in, int depth)
+{
+  if (unlikely(depth > MRB_ZMQ_PACK_MAX_DEPTH || in->p >= in->end)) {
+    mrb_zmq_unpack_malformed(mrb);
+  }
+
+  switch (*in->p++) {
+    case MRB_ZMQ_PACK_NIL:
+      return mrb_nil_value();
+    case MRB_ZMQ_PACK_FALSE:
+      return mrb_false_value();
+    case MRB_ZMQ_PACK_TRUE:
+      return mrb_true_value();
+    case MRB_ZMQ_PACK_INTEGER: {
+      uint64_t zigzag = mrb_zmq_unpack_varint(mrb, in);
+      int64_t value = (int64_t) ((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+#ifdef MRB_INT32
+      if (unlikely(value < MRB_INT_MIN || value > MRB_INT_MAX)) {
+        mrb_raise(mrb, E_RANGE_ERROR, "packed Integer too big for this mruby");
+      }
+#endif
+      return mrb_int_value(mrb, (mrb_int) value);
+    }
+    case MRB_ZMQ_PACK_FLOAT: {
+#ifndef MRB_NO_FLOAT
+      if (unlikely(in->end - in->p < 8)) {
+        mrb_zmq_unpack_malformed(mrb);
+      }
+      uint64_t bits = 0;
+      for (int i = 0; i < 8; i++) {
+        bits |= (uint64_t) *in->p++ << (i * 8);
+      }
+      double value;
+      memcpy(&value, &bits, sizeof(value));
+      return mrb_float_value(mrb, (mrb_float) value);
+#else
+      mrb_raise(mrb, E_NOTIMP_ERROR, "this mruby has no Float");
+#endif
+    }
+    case MRB_ZMQ_PACK_STRING: {
+      size_t len = mrb_zmq_unpack_len(mrb, in);
+      mrb_value str = mrb_str_new(mrb, (const char *) in->p, len);
+      in->p += len;
+      return str;
+    }
+    case MRB_ZMQ_PACK_SYMBOL: {
+      size_t len = mrb_zmq_unpack_len(mrb, in);
+      mrb_sym sym = mrb_intern(mrb, (const char *) in->p, len);
+      in->p += len;
+      return mrb_symbol_value(sym);
+    }
+    case MRB_ZMQ_PACK_ARRAY: {
+      size_t count = mrb_zmq_unpack_len(mrb, in); // every element takes at least one byte
+      mrb_value ary = mrb_ary_new_capa(mrb, count);
+      int ai = mrb_gc_arena_save(mrb);
+      for (size_t i = 0; i < count; i++) {
+        mrb_ary_push(mrb, ary, mrb_zmq_unpack_value(mrb, in, depth + 1));
+        mrb_gc_arena_restore(mrb, ai);
+      }
+      return ary;
+    }
+    case MRB_ZMQ_PACK_HASH: {
+      size_t count = mrb_zmq_unpack_len(mrb, in);
+      mrb_value hash = mrb_hash_new_capa(mrb, count);
+      int ai = mrb_gc_arena_save(mrb);
+      for (size_t i = 0; i < count; i++) {
+        mrb_value key = mrb_zmq_unpack_value(mrb, in, depth + 1);
+        mrb_value value = mrb_zmq_unpack_value(mrb, in, depth + 1);
+        mrb_hash_set(mrb, hash, key, value);
+        mrb_gc_arena_restore(mrb, ai);
+      }
+      return hash;
+    }
+    default:
+      mrb_zmq_unpack_malformed(mrb);
+  }
+
+  return mrb_nil_value();
+}
+
+static mrb_value
+mrb_zmq_msg_unpack(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg = (zmq_msg_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_msg_type);
+  mrb_zmq_unpack_t in;
+  in.p = (const uint8_t *) zmq_msg_data(msg);
+  in.end = in.p + zmq_msg_size(msg);
+
+  mrb_value obj = mrb_zmq_unpack_value(mrb, &in, 0);
+  if (unlikely(in.p != in.end)) {
+    mrb_zmq_unpack_malformed(mrb);
+  }
+
+  return obj;
+}
+
+static mrb_value
+mrb_zmq_msg_copy(mrb_state *mrb, mrb_value copy)
+{
+  zmq_msg_t* msg_src;
+  mrb_get_args(mrb, "d", &msg_src, &mrb_zmq_msg_type);
+  if (msg_src && msg_src == DATA_PTR(copy)) return copy;
+
+  if (unlikely(!msg_src)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "uninitialized src msg");
+  }
+
+  zmq_msg_t *msg_copy = (zmq_msg_t *) DATA_PTR(copy);
+  if (msg_copy) {
+    zmq_msg_close(msg_copy);
+  } else {
+    msg_copy = mrb_zmq_msg_alloc(mrb);
+    mrb_data_init(copy, msg_copy, &mrb_zmq_msg_type);
+  }
+  zmq_msg_init(msg_copy);
+  int rc = zmq_msg_copy(msg_copy, msg_src);
+  int err = mrb_zmq_errno();
+  mrb_zmq_msg_account_shared(msg_copy);
+  if (unlikely(-1 == rc)) {
+    errno = err;
+    mrb_zmq_handle_error(mrb, "zmq_msg_copy");
+  }
+  return copy;
+}
+
+static mrb_value
+mrb_zmq_msg_gets(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg;
+  char *property;
+  mrb_get_args(mrb, "dz", &msg, &mrb_zmq_msg_type, &property);
+
+  const char *prop = zmq_msg_gets(msg, property);
+  if (prop) {
+    return mrb_str_new_cstr(mrb, prop);
+  } else {
+    return mrb_nil_value();
+  }
+}
+
+// sends a reference to the payload of msg, msg itself stays untouched.
+static int
+mrb_zmq_msg_send_ref(zmq_msg_t *msg, void *socket, int flags)
+{
+  zmq_msg_t copy;
+  zmq_msg_init(&copy);
+  int rc = zmq_msg_copy(&copy, msg);
+  if (likely(rc != -1)) {
+    rc = zmq_msg_send(&copy, socket, flags);
+  }
+  if (unlikely(-1 == rc)) {
+    int err = mrb_zmq_errno();
+    zmq_msg_close(&copy);
+    errno = err;
+  }
+
+  return rc;
+}
+
+// sends the payload of a ZMQ::Msg, which is empty afterwards.
+static int
+mrb_zmq_msg_send_val(mrb_state *mrb, mrb_value msg_val, void *socket, int flags)
+{
+  zmq_msg_t *msg = (zmq_msg_t *) mrb_data_get_ptr(mrb, msg_val, &mrb_zmq_msg_type);
+
+  int rc = zmq_msg_send(msg, socket, flags);
+  if (likely(rc != -1)) {
+    mrb_zmq_msg_account(mrb, msg); // libzmq took the payload
+    mrb_iv_remove(mrb, msg_val, MRB_SYM(view)); // a view keeps its own reference
+  }
+
+  return rc;
+}
+
+static mrb_value
+mrb_zmq_msg_send(mrb_state *mrb, mrb_value self)
 {
+  mrb_value msg_val;
   void *socket;
-  mrb_int option_name;
-  mrb_value option_value;
-  mrb_get_args(mrb, "dio", &socket, &mrb_zmq_socket_type, &option_name, &option_value);
-  mrb_assert_int_fit(mrb_int, option_name, int, INT_MAX);
+  mrb_int flags;
+  mrb_get_args(mrb, "odi", &msg_val, &socket, &mrb_zmq_socket_type, &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
 
-  int rc = 0;
+  int rc = mrb_zmq_msg_send_val(mrb, msg_val, socket, (int) flags);
+  MRB_ZMQ_STATS_SENT(mrb, mrb_get_argv(mrb)[1], rc, rc);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_msg_send");
+  }
 
-  switch(mrb_type(option_value)) {
-    case MRB_TT_FALSE: {
-      if (!mrb_integer(option_value)) {
-        rc = zmq_setsockopt(socket, option_name, NULL, 0);
+  return mrb_nil_value();
+}
+
+// the exception mrb_zmq_handle_error would raise for errno, for mrb_protect
+static mrb_value
+mrb_zmq_msg_send_error(mrb_state *mrb, mrb_value unused)
+{
+  mrb_zmq_handle_error(mrb, "zmq_msg_send");
+  return mrb_nil_value();
+}
+
+// sends a reference to the payload of msg to every socket, libzmq only bumps its refcount per socket.
+// returns the bytes sent per socket, nil where the socket couldn't take it right now
+// and the exception it failed with where sending failed otherwise. msg stays untouched.
+// Every element is checked before anything gets sent.
+static mrb_value
+mrb_zmq_msg_send_many(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg;
+  mrb_value sockets;
+  mrb_int flags;
+  mrb_get_args(mrb, "dAi", &msg, &mrb_zmq_msg_type, &sockets, &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+
+  mrb_int n_sockets = RARRAY_LEN(sockets);
+  for (mrb_int i = 0; i < n_sockets; i++) {
+    mrb_value socket_val = RARRAY_PTR(sockets)[i];
+    mrb_data_check_type(mrb, socket_val, &mrb_zmq_socket_type);
+    if (unlikely(!DATA_PTR(socket_val))) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "socket is closed");
+    }
+  }
+
+  mrb_value results = mrb_ary_new_capa(mrb, n_sockets);
+  int ai = mrb_gc_arena_save(mrb);
+  for (mrb_int i = 0; i < n_sockets; i++) {
+    mrb_value socket_val = mrb_ary_ref(mrb, sockets, i);
+    void *socket = DATA_PTR(socket_val);
+
+    int rc = mrb_zmq_msg_send_ref(msg, socket, (int) flags);
+    MRB_ZMQ_STATS_SENT(mrb, socket_val, rc, rc);
+    if (unlikely(-1 == rc)) {
+      if (mrb_zmq_errno() == EAGAIN) {
+        mrb_ary_push(mrb, results, mrb_nil_value());
       } else {
-        int boolean = 0;
-        rc = zmq_setsockopt(socket, option_name, &boolean, sizeof(boolean));
+        mrb_bool failed;
+        mrb_ary_push(mrb, results, mrb_protect(mrb, mrb_zmq_msg_send_error, mrb_nil_value(), &failed));
       }
-    } break;
-    case MRB_TT_TRUE: {
-      int boolean = 1;
-      rc = zmq_setsockopt(socket, option_name, &boolean, sizeof(boolean));
-    } break;
-    case MRB_TT_INTEGER: {
-      int number = (int) mrb_integer(option_value);
-      rc = zmq_setsockopt(socket, option_name, &number, sizeof(number));
-    } break;
-    case MRB_TT_FLOAT: {
-      int64_t number = (int64_t) mrb_float(option_value);
-      rc = zmq_setsockopt(socket, option_name, &number, sizeof(number));
-    } break;
-    case MRB_TT_STRING: {
-      rc = zmq_setsockopt(socket, option_name, RSTRING_PTR(option_value), RSTRING_LEN(option_value));
-    } break;
-    default: {
-      mrb_raise(mrb, E_TYPE_ERROR, "expected nil|false|true|Integer|Float|String as value");
+    } else {
+      mrb_ary_push(mrb, results, mrb_convert_number(mrb, rc));
+    }
+    mrb_gc_arena_restore(mrb, ai);
+  }
+
+  return results;
+}
+
+// like msg_send with DONTWAIT, returns false instead of raising when the socket can't take it right now.
+static mrb_value
+mrb_zmq_msg_try_send(mrb_state *mrb, mrb_value self)
+{
+  mrb_value msg_val;
+  void *socket;
+  mrb_int flags;
+  mrb_get_args(mrb, "odi", &msg_val, &socket, &mrb_zmq_socket_type, &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+
+  int rc = mrb_zmq_msg_send_val(mrb, msg_val, socket, (int) flags | ZMQ_DONTWAIT);
+  MRB_ZMQ_STATS_SENT(mrb, mrb_get_argv(mrb)[1], rc, rc);
+  if (unlikely(-1 == rc)) {
+    if (likely(mrb_zmq_errno() == EAGAIN)) {
+      return mrb_false_value();
+    }
+    mrb_zmq_handle_error(mrb, "zmq_msg_send");
+  }
+
+  return mrb_true_value();
+}
+
+static mrb_value
+mrb_zmq_msg_size(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg;
+  mrb_get_args(mrb, "d", &msg, &mrb_zmq_msg_type);
+
+  return mrb_convert_number(mrb, zmq_msg_size(msg));
+}
+
+static mrb_value
+mrb_zmq_proxy(mrb_state *mrb, mrb_value self)
+{
+  void *frontend, *backend, *capture = NULL;
+  mrb_get_args(mrb, "dd|d!", &frontend, &mrb_zmq_socket_type, &backend, &mrb_zmq_socket_type, &capture, &mrb_zmq_socket_type);
+
+  int rc = zmq_proxy(frontend, backend, capture);
+  if (-1 == rc) {
+    mrb_zmq_handle_error(mrb, "zmq_proxy");
+  }
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_proxy_steerable(mrb_state *mrb, mrb_value self)
+{
+  void *frontend, *backend, *control, *capture = NULL;
+  mrb_get_args(mrb, "ddd|d!", &frontend, &mrb_zmq_socket_type, &backend, &mrb_zmq_socket_type, &control, &mrb_zmq_socket_type,
+    &capture, &mrb_zmq_socket_type);
+
+  int rc = zmq_proxy_steerable(frontend, backend, capture, control);
+  if (-1 == rc) {
+    mrb_zmq_handle_error(mrb, "zmq_proxy");
+  }
+
+  return self;
+}
+
+static void
+mrb_zmq_proxy_close_socket(void *socket)
+{
+  if (socket) {
+    int wait500ms = 500;
+    zmq_setsockopt(socket, ZMQ_LINGER, &wait500ms, sizeof(wait500ms));
+    zmq_close(socket);
+  }
+}
+
+// terminates the proxy thread, waits for it and closes its sockets.
+static void
+mrb_zmq_proxy_stop(mrb_zmq_proxy_t *proxy)
+{
+  if (proxy->handle) {
+    if (!proxy->finished.load(std::memory_order_acquire)) {
+      zmq_send(proxy->pipe, "TERMINATE", 9, 0);
+    }
+    zmq_threadclose(proxy->handle);
+    proxy->handle = NULL;
+  }
+  mrb_zmq_proxy_close_socket(proxy->frontend);
+  mrb_zmq_proxy_close_socket(proxy->backend);
+  mrb_zmq_proxy_close_socket(proxy->capture);
+  mrb_zmq_proxy_close_socket(proxy->control);
+  mrb_zmq_proxy_close_socket(proxy->pipe);
+  proxy->frontend = proxy->backend = proxy->capture = proxy->control = proxy->pipe = NULL;
+}
+
+static void
+mrb_zmq_proxy_fn(void *proxy_)
+{
+  mrb_zmq_proxy_t *proxy = (mrb_zmq_proxy_t *) proxy_;
+  proxy->rc = zmq_proxy_steerable(proxy->frontend, proxy->backend, proxy->capture, proxy->control);
+  proxy->err = proxy->rc == -1 ? zmq_errno() : 0;
+  proxy->finished.store(true, std::memory_order_release);
+}
+
+// takes the libzmq socket away from its ZMQ::Socket, for sockets handed over to a native thread.
+static void *
+mrb_zmq_take_socket(mrb_state *mrb, mrb_value socket_val)
+{
+  if (mrb_nil_p(socket_val)) {
+    return NULL;
+  }
+  void *socket = mrb_data_get_ptr(mrb, socket_val, &mrb_zmq_socket_type);
+  if (unlikely(!socket)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "socket is closed");
+  }
+  mrb_data_init(socket_val, NULL, &mrb_zmq_socket_type);
+
+  return socket;
+}
+
+// runs zmq_proxy_steerable on a native thread, steered from here through a inproc Pair.
+static mrb_value
+mrb_zmq_proxy_new(mrb_state *mrb, mrb_value self)
+{
+  if (unlikely(DATA_PTR(self))) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Proxy instance already initialized");
+  }
+
+  mrb_value frontend, backend, capture = mrb_nil_value();
+  mrb_get_args(mrb, "oo|o", &frontend, &backend, &capture);
+  mrb_data_get_ptr(mrb, frontend, &mrb_zmq_socket_type);
+  mrb_data_get_ptr(mrb, backend, &mrb_zmq_socket_type);
+
+  mrb_zmq_proxy_t *proxy = new mrb_zmq_proxy_t();
+  proxy->finished = false;
+  mrb_data_init(self, proxy, &mrb_zmq_proxy_type);
+
+  char endpoint[64];
+  snprintf(endpoint, sizeof(endpoint), "inproc://mrb-zmq-proxy-%p", (void *) proxy);
+  void *context = MRB_LIBZMQ_CONTEXT(mrb);
+  proxy->pipe = zmq_socket(context, ZMQ_PAIR);
+  if (unlikely(!proxy->pipe)) {
+    mrb_zmq_handle_error(mrb, "zmq_socket");
+  }
+  if (unlikely(-1 == zmq_bind(proxy->pipe, endpoint))) {
+    mrb_zmq_handle_error(mrb, "zmq_bind");
+  }
+  proxy->control = zmq_socket(context, ZMQ_PAIR);
+  if (unlikely(!proxy->control)) {
+    mrb_zmq_handle_error(mrb, "zmq_socket");
+  }
+  if (unlikely(-1 == zmq_connect(proxy->control, endpoint))) {
+    mrb_zmq_handle_error(mrb, "zmq_connect");
+  }
+
+  proxy->frontend = mrb_zmq_take_socket(mrb, frontend);
+  proxy->backend = mrb_zmq_take_socket(mrb, backend);
+  proxy->capture = mrb_zmq_take_socket(mrb, capture);
+  proxy->handle = zmq_threadstart(mrb_zmq_proxy_fn, proxy);
+  if (unlikely(!proxy->handle)) {
+    mrb_zmq_handle_error(mrb, "zmq_threadstart");
+  }
+  mrb_hash_set(mrb, mrb_zmq_get_state(mrb)->proxies, mrb_zmq_ptr_key(mrb, proxy), self);
+
+  return self;
+}
+
+static mrb_zmq_proxy_t *
+mrb_zmq_proxy_running(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_proxy_t *proxy = (mrb_zmq_proxy_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_proxy_type);
+  if (unlikely(!proxy || !proxy->handle || proxy->finished.load(std::memory_order_acquire))) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Proxy isn't running");
+  }
+
+  return proxy;
+}
+
+static void
+mrb_zmq_proxy_command(mrb_state *mrb, mrb_zmq_proxy_t *proxy, const char *command)
+{
+  if (unlikely(-1 == zmq_send(proxy->pipe, command, strlen(command), 0))) {
+    mrb_zmq_handle_error(mrb, "zmq_send");
+  }
+}
+
+static mrb_value
+mrb_zmq_proxy_pause(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_proxy_command(mrb, mrb_zmq_proxy_running(mrb, self), "PAUSE");
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_proxy_resume(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_proxy_command(mrb, mrb_zmq_proxy_running(mrb, self), "RESUME");
+
+  return self;
+}
+
+#if ZMQ_VERSION >= ZMQ_MAKE_VERSION(4,3,0)
+// the proxy answers STATISTICS with eight uint64_t frames,
+// messages and bytes received and sent by the frontend followed by the same for the backend.
+static mrb_value
+mrb_zmq_proxy_statistics(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_proxy_t *proxy = mrb_zmq_proxy_running(mrb, self);
+  mrb_zmq_proxy_command(mrb, proxy, "STATISTICS");
+
+  uint64_t counters[8];
+  for (size_t i = 0; i < NELEMS(counters); i++) {
+    int rc = zmq_recv(proxy->pipe, &counters[i], sizeof(counters[i]), 0);
+    if (unlikely(-1 == rc)) {
+      mrb_zmq_handle_error(mrb, "zmq_recv");
+    }
+  }
+
+  const mrb_sym sides[] = { MRB_SYM(frontend), MRB_SYM(backend) };
+  mrb_value statistics = mrb_hash_new_capa(mrb, NELEMS(sides));
+  for (size_t i = 0; i < NELEMS(sides); i++) {
+    const uint64_t *counter = &counters[i * 4];
+    mrb_value side = mrb_hash_new_capa(mrb, 4);
+    mrb_hash_set(mrb, side, mrb_symbol_value(MRB_SYM(messages_in)),  mrb_convert_number(mrb, counter[0]));
+    mrb_hash_set(mrb, side, mrb_symbol_value(MRB_SYM(bytes_in)),     mrb_convert_number(mrb, counter[1]));
+    mrb_hash_set(mrb, side, mrb_symbol_value(MRB_SYM(messages_out)), mrb_convert_number(mrb, counter[2]));
+    mrb_hash_set(mrb, side, mrb_symbol_value(MRB_SYM(bytes_out)),    mrb_convert_number(mrb, counter[3]));
+    mrb_hash_set(mrb, statistics, mrb_symbol_value(sides[i]), side);
+  }
+
+  return statistics;
+}
+#endif
+
+// stops the proxy and closes its sockets, raises when the proxy failed for another reason than being terminated.
+static mrb_value
+mrb_zmq_proxy_terminate(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_proxy_t *proxy = (mrb_zmq_proxy_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_proxy_type);
+  if (unlikely(!proxy)) {
+    return mrb_nil_value();
+  }
+
+  mrb_zmq_proxy_stop(proxy);
+  mrb_hash_delete_key(mrb, mrb_zmq_get_state(mrb)->proxies, mrb_zmq_ptr_key(mrb, proxy));
+  if (unlikely(proxy->rc == -1 && proxy->err != ETERM)) {
+    errno = proxy->err;
+    proxy->rc = 0;
+    mrb_zmq_handle_error(mrb, "zmq_proxy_steerable");
+  }
+
+  return mrb_nil_value();
+}
+
+static mrb_value
+mrb_zmq_proxy_running_p(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_proxy_t *proxy = (mrb_zmq_proxy_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_proxy_type);
+
+  return mrb_bool_value(proxy && proxy->handle && !proxy->finished.load(std::memory_order_acquire));
+}
+
+static mrb_value
+mrb_zmq_msg_to_str(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg_ = (zmq_msg_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_msg_type);
+  return mrb_str_new(mrb, (const char *) zmq_msg_data(msg_), zmq_msg_size(msg_));
+}
+
+#ifdef MRB_ZMQ_SHARED_VIEW
+#if MRUBY_RELEASE_MAJOR != 3
+#error "MRB_ZMQ_SHARED_VIEW relies on mruby 3 string internals"
+#endif
+// returns a String which points at size bytes owned by keeper, keeper stays alive as long as the String
+// or any substring of it is reachable.
+// This makes keeper the shared parent of the String although it isn't a RString. That holds with mruby 3:
+// the GC only marks aux.fshared, substrings only copy the pointer and a FSHARED String never frees its buffer,
+// nothing reads it as a RString. It depends on undocumented internals, so it is only built on request.
+static mrb_value
+mrb_zmq_str_new_shared(mrb_state *mrb, const char *data, size_t size, struct RBasic *keeper)
+{
+  mrb_value str = mrb_str_new_static(mrb, data, size);
+  struct RString *s = mrb_str_ptr(str);
+  if (unlikely(RSTR_EMBED_P(s) || !RSTR_NOFREE_P(s))) {
+    return mrb_str_new(mrb, data, size);
+  }
+  RSTR_UNSET_NOFREE_FLAG(s);
+  s->as.heap.aux.fshared = (struct RString *) keeper;
+  RSTR_SET_FSHARED_FLAG(s);
+  mrb_field_write_barrier(mrb, (struct RBasic *) s, keeper);
+
+  return str;
+}
+#endif
+
+// returns a frozen String with the payload of the msg, cached until the msg gets a new payload.
+// Built with MRB_ZMQ_SHARED_VIEW it points directly into the payload and holds its own reference to it
+// in a hidden ZMQ::Msg, so the payload stays alive as long as the view or any substring of it is reachable,
+// even when the msg gets sent or released. Otherwise it is a copy.
+static mrb_value
+mrb_zmq_msg_view(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg_ = (zmq_msg_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_msg_type);
+  mrb_value view = mrb_iv_get(mrb, self, MRB_SYM(view));
+  if (mrb_string_p(view)) {
+    return view;
+  }
+
+  size_t size = zmq_msg_size(msg_);
+#ifdef MRB_ZMQ_SHARED_VIEW
+  if (size >= MRB_ZMQ_ZERO_COPY_MIN_SIZE) {
+    // a zmq_msg_copy of a msg this large only takes another reference on its payload.
+    mrb_value keeper = mrb_obj_value(mrb_data_object_alloc(mrb, mrb_obj_class(mrb, self), NULL, NULL));
+    zmq_msg_t *ref = mrb_zmq_msg_alloc(mrb);
+    zmq_msg_init(ref);
+    mrb_data_init(keeper, ref, &mrb_zmq_msg_type);
+    if (unlikely(-1 == zmq_msg_copy(ref, msg_))) {
+      mrb_zmq_handle_error(mrb, "zmq_msg_copy");
+    }
+    view = mrb_zmq_str_new_shared(mrb, (const char *) zmq_msg_data(ref), size, mrb_basic_ptr(keeper));
+  } else
+#endif
+  {
+    view = mrb_str_new(mrb, (const char *) zmq_msg_data(msg_), size);
+  }
+  MRB_SET_FROZEN_FLAG(mrb_basic_ptr(view));
+  mrb_iv_set(mrb, self, MRB_SYM(view), view);
+
+  return view;
+}
+
+// frees the payload right away instead of waiting for the GC, the msg is empty afterwards.
+// A view keeps its own reference, its bytes are freed once the view is unreachable.
+static mrb_value
+mrb_zmq_msg_release(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg = (zmq_msg_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_msg_type);
+  if (unlikely(!msg)) {
+    return self;
+  }
+  mrb_iv_remove(mrb, self, MRB_SYM(view));
+
+  zmq_msg_close(msg);
+  zmq_msg_init(msg);
+  mrb_zmq_msg_account(mrb, msg);
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_msg_eql(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *other;
+  mrb_get_args(mrb, "d", &other, &mrb_zmq_msg_type);
+
+  zmq_msg_t *msg = (zmq_msg_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_msg_type);
+
+  if (msg == other) {
+    return mrb_true_value();
+  } else if (zmq_msg_size(msg) != zmq_msg_size(other)) {
+    return mrb_false_value();
+  } else {
+    return mrb_bool_value(memcmp(zmq_msg_data(msg), zmq_msg_data(other), zmq_msg_size(msg)) == 0);
+  }
+}
+
+static mrb_value
+mrb_zmq_send(mrb_state *mrb, mrb_value self)
+{
+  void *socket;
+  mrb_value message;
+  mrb_int flags;
+  mrb_get_args(mrb, "doi", &socket, &mrb_zmq_socket_type, &message, &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+
+  message = mrb_str_to_str(mrb, message);
+
+  int rc = zmq_send(socket, RSTRING_PTR(message), RSTRING_LEN(message), flags);
+  MRB_ZMQ_STATS_SENT(mrb, mrb_get_argv(mrb)[0], rc, rc);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_send");
+  }
+
+  return mrb_convert_number(mrb, rc);
+}
+
+// sends every element of a Array as one multipart message, ZMQ::Msg elements are sent by reference and stay untouched.
+// returns the number of frames queued, which is less than the Array size when EAGAIN was hit after the first frame.
+// returns -1 and leaves errno alone when the first frame couldn't be queued.
+// The stats of socket_val count the whole multipart message as one.
+static mrb_int
+mrb_zmq_send_frames(mrb_state *mrb, mrb_value socket_val, void *socket, mrb_value frames, int flags)
+{
+  mrb_int n_frames = RARRAY_LEN(frames);
+  if (unlikely(n_frames == 0)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "cannot send a empty multipart message");
+  }
+
+  int ai = mrb_gc_arena_save(mrb);
+  size_t bytes = 0;
+  mrb_int i;
+  for (i = 0; i < n_frames; i++) {
+    int frame_flags = (int) flags;
+    if (i < n_frames - 1) {
+      frame_flags |= ZMQ_SNDMORE;
+    }
+    mrb_value frame = mrb_ary_ref(mrb, frames, i);
+    int rc;
+    if (mrb_type(frame) == MRB_TT_DATA && DATA_TYPE(frame) == &mrb_zmq_msg_type) {
+      rc = mrb_zmq_msg_send_ref((zmq_msg_t *) DATA_PTR(frame), socket, frame_flags);
+    } else {
+      frame = mrb_str_to_str(mrb, frame);
+      rc = zmq_send(socket, RSTRING_PTR(frame), RSTRING_LEN(frame), frame_flags);
+    }
+    mrb_gc_arena_restore(mrb, ai);
+
+    if (unlikely(-1 == rc)) {
+      if (i > 0 && mrb_zmq_errno() == EAGAIN) {
+        break;
+      }
+      MRB_ZMQ_STATS_SENT(mrb, socket_val, -1, 0);
+      if (i == 0) {
+        return -1;
+      }
+      mrb_zmq_handle_error(mrb, "zmq_send");
+    }
+    bytes += (size_t) rc;
+  }
+  MRB_ZMQ_STATS_SENT(mrb, socket_val, 0, bytes);
+
+  return i;
+}
+
+static mrb_value
+mrb_zmq_send_multipart(mrb_state *mrb, mrb_value self)
+{
+  void *socket;
+  mrb_value frames;
+  mrb_int flags;
+  mrb_get_args(mrb, "dAi", &socket, &mrb_zmq_socket_type, &frames, &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+
+  mrb_int sent = mrb_zmq_send_frames(mrb, mrb_get_argv(mrb)[0], socket, frames, (int) flags);
+  if (unlikely(-1 == sent)) {
+    mrb_zmq_handle_error(mrb, "zmq_send");
+  }
+
+  return mrb_convert_number(mrb, sent);
+}
+
+// sends a String, a ZMQ::Msg by reference or a Array as one multipart message with DONTWAIT.
+// returns false instead of raising when the socket can't take it right now,
+// and the number of frames sent when only the start of a multipart message went out.
+static mrb_value
+mrb_zmq_socket_try_send(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data;
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "o|i", &data, &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+  void *socket = mrb_data_get_ptr(mrb, self, &mrb_zmq_socket_type);
+  int send_flags = (int) flags | ZMQ_DONTWAIT;
+
+  mrb_int rc;
+  if (mrb_array_p(data)) {
+    rc = mrb_zmq_send_frames(mrb, self, socket, data, send_flags);
+    if (unlikely(rc != -1 && rc < RARRAY_LEN(data))) {
+      return mrb_convert_number(mrb, rc);
+    }
+  } else if (mrb_type(data) == MRB_TT_DATA && DATA_TYPE(data) == &mrb_zmq_msg_type) {
+    rc = mrb_zmq_msg_send_ref((zmq_msg_t *) DATA_PTR(data), socket, send_flags);
+    MRB_ZMQ_STATS_SENT(mrb, self, (int) rc, rc);
+  } else {
+    data = mrb_str_to_str(mrb, data);
+    rc = zmq_send(socket, RSTRING_PTR(data), RSTRING_LEN(data), send_flags);
+    MRB_ZMQ_STATS_SENT(mrb, self, (int) rc, rc);
+  }
+  if (unlikely(-1 == rc)) {
+    if (likely(mrb_zmq_errno() == EAGAIN)) {
+      return mrb_false_value();
+    }
+    mrb_zmq_handle_error(mrb, "zmq_send");
+  }
+
+  return mrb_true_value();
+}
+
+static mrb_value
+mrb_zmq_send_zero_copy(mrb_state *mrb, mrb_value self)
+{
+  void *socket;
+  mrb_value message;
+  mrb_int flags;
+  mrb_get_args(mrb, "dSi", &socket, &mrb_zmq_socket_type, &message, &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+
+  zmq_msg_t msg;
+  mrb_zmq_msg_init_zero_copy(mrb, &msg, message);
+
+  int rc = zmq_msg_send(&msg, socket, flags);
+  if (unlikely(-1 == rc)) {
+    int err = mrb_zmq_errno();
+    zmq_msg_close(&msg);
+    errno = err;
+    mrb_zmq_handle_error(mrb, "zmq_msg_send");
+  }
+
+  return mrb_convert_number(mrb, rc);
+}
+
+static const mrb_zmq_sockopt_t mrb_zmq_sockopts[] = {
+#include "zmq_sockopt.cstub"
+};
+
+// reads a option from the table with a buffer of its own size, returns false with errno set on failure.
+static mrb_bool
+mrb_zmq_sockopt_read(mrb_state *mrb, void *socket, const mrb_zmq_sockopt_t *opt, mrb_value *result)
+{
+  int rc;
+  switch (opt->type) {
+    case MRB_ZMQ_SOCKOPT_INT:
+    case MRB_ZMQ_SOCKOPT_BOOL: {
+      int number;
+      size_t option_len = sizeof(number);
+      rc = zmq_getsockopt(socket, opt->id, &number, &option_len);
+      *result = opt->type == MRB_ZMQ_SOCKOPT_BOOL ? mrb_bool_value(number) : mrb_convert_number(mrb, number);
+    } break;
+    case MRB_ZMQ_SOCKOPT_INT64: {
+      int64_t number;
+      size_t option_len = sizeof(number);
+      rc = zmq_getsockopt(socket, opt->id, &number, &option_len);
+      *result = mrb_convert_number(mrb, number);
+    } break;
+    case MRB_ZMQ_SOCKOPT_UINT64: {
+      uint64_t number;
+      size_t option_len = sizeof(number);
+      rc = zmq_getsockopt(socket, opt->id, &number, &option_len);
+      *result = mrb_convert_number(mrb, number);
+    } break;
+    case MRB_ZMQ_SOCKOPT_FD: {
+      SOCKET fd;
+      size_t option_len = sizeof(fd);
+      rc = zmq_getsockopt(socket, opt->id, &fd, &option_len);
+      *result = mrb_convert_number(mrb, fd);
+    } break;
+    default: {
+      char buf[1024];
+      size_t option_len = opt->max_size < sizeof(buf) ? opt->max_size : sizeof(buf);
+      rc = zmq_getsockopt(socket, opt->id, buf, &option_len);
+      if (rc != -1 && opt->type == MRB_ZMQ_SOCKOPT_STRING && option_len > 0) {
+        option_len--;
+      }
+      *result = rc == -1 ? mrb_nil_value() : mrb_str_new(mrb, buf, option_len);
+    }
+  }
+
+  return rc != -1;
+}
+
+// the index into mrb_zmq_sockopts is the only env value of the accessor procs
+static mrb_value
+mrb_zmq_sockopt_get(mrb_state *mrb, mrb_value self)
+{
+  const mrb_zmq_sockopt_t *opt = &mrb_zmq_sockopts[mrb_integer(mrb_proc_cfunc_env_get(mrb, 0))];
+  mrb_value result;
+  if (unlikely(!mrb_zmq_sockopt_read(mrb, mrb_data_get_ptr(mrb, self, &mrb_zmq_socket_type), opt, &result))) {
+    mrb_zmq_handle_error(mrb, "zmq_getsockopt");
+  }
+
+  return result;
+}
+
+static mrb_value
+mrb_zmq_sockopt_set(mrb_state *mrb, mrb_value self)
+{
+  const mrb_zmq_sockopt_t *opt = &mrb_zmq_sockopts[mrb_integer(mrb_proc_cfunc_env_get(mrb, 0))];
+  mrb_value option_value = mrb_nil_value();
+  mrb_get_args(mrb, "|o", &option_value);
+  void *socket = mrb_data_get_ptr(mrb, self, &mrb_zmq_socket_type);
+
+  int rc;
+  switch (opt->type) {
+    case MRB_ZMQ_SOCKOPT_BOOL: {
+      int boolean = mrb_test(option_value);
+      rc = zmq_setsockopt(socket, opt->id, &boolean, sizeof(boolean));
+    } break;
+    case MRB_ZMQ_SOCKOPT_INT64:
+    case MRB_ZMQ_SOCKOPT_UINT64: {
+      int64_t number = mrb_float_p(option_value) ? (int64_t) mrb_float(option_value) : (int64_t) mrb_integer(mrb_to_int(mrb, option_value));
+      rc = zmq_setsockopt(socket, opt->id, &number, sizeof(number));
+    } break;
+    case MRB_ZMQ_SOCKOPT_STRING:
+    case MRB_ZMQ_SOCKOPT_BINARY: {
+      if (mrb_nil_p(option_value)) {
+        rc = zmq_setsockopt(socket, opt->id, NULL, 0);
+      } else {
+        option_value = mrb_str_to_str(mrb, option_value);
+        rc = zmq_setsockopt(socket, opt->id, RSTRING_PTR(option_value), RSTRING_LEN(option_value));
+      }
+    } break;
+    default: {
+      mrb_int number = mrb_integer(mrb_to_int(mrb, option_value));
+      mrb_assert_int_fit(mrb_int, number, int, INT_MAX);
+      int int_number = (int) number;
+      rc = zmq_setsockopt(socket, opt->id, &int_number, sizeof(int_number));
+    }
+  }
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_setsockopt");
+  }
+
+  return option_value;
+}
+
+// Socket#options(*names), reads every readable option the socket type supports when no names are given.
+// The env holds a Hash of option name => index into mrb_zmq_sockopts.
+static mrb_value
+mrb_zmq_socket_options(mrb_state *mrb, mrb_value self)
+{
+  const mrb_value *names;
+  mrb_int names_len;
+  mrb_get_args(mrb, "*", &names, &names_len);
+  void *socket = mrb_data_get_ptr(mrb, self, &mrb_zmq_socket_type);
+  mrb_value readable = mrb_proc_cfunc_env_get(mrb, 0);
+  mrb_value result;
+
+  if (names_len == 0) {
+    mrb_value keys = mrb_hash_keys(mrb, readable);
+    result = mrb_hash_new_capa(mrb, RARRAY_LEN(keys));
+    int ai = mrb_gc_arena_save(mrb);
+    for (mrb_int i = 0; i < RARRAY_LEN(keys); i++) {
+      mrb_value name = mrb_ary_ref(mrb, keys, i);
+      mrb_value value;
+      if (mrb_zmq_sockopt_read(mrb, socket, &mrb_zmq_sockopts[mrb_integer(mrb_hash_get(mrb, readable, name))], &value)) {
+        mrb_hash_set(mrb, result, name, value);
+      } else if (unlikely(mrb_zmq_errno() != EINVAL)) {
+        mrb_zmq_handle_error(mrb, "zmq_getsockopt");
+      }
+      mrb_gc_arena_restore(mrb, ai);
+    }
+    return result;
+  }
+
+  result = mrb_hash_new_capa(mrb, names_len);
+  for (mrb_int i = 0; i < names_len; i++) {
+    mrb_value name = mrb_string_p(names[i]) ? mrb_str_intern(mrb, names[i]) : names[i];
+    mrb_value index = mrb_hash_get(mrb, readable, name);
+    if (unlikely(!mrb_integer_p(index))) {
+      mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown socket option %v", names[i]);
+    }
+    mrb_value value;
+    if (unlikely(!mrb_zmq_sockopt_read(mrb, socket, &mrb_zmq_sockopts[mrb_integer(index)], &value))) {
+      mrb_zmq_handle_error(mrb, "zmq_getsockopt");
+    }
+    mrb_hash_set(mrb, result, name, value);
+  }
+
+  return result;
+}
+
+static void
+mrb_zmq_define_sockopts(mrb_state *mrb, struct RClass *zmq_socket_class)
+{
+  mrb_value readable = mrb_hash_new(mrb);
+  for (size_t i = 0; i < NELEMS(mrb_zmq_sockopts); i++) {
+    const mrb_zmq_sockopt_t *opt = &mrb_zmq_sockopts[i];
+    mrb_value index = mrb_int_value(mrb, (mrb_int) i);
+    char name[64];
+    mrb_method_t method;
+    if (opt->access & MRB_ZMQ_SOCKOPT_R) {
+      snprintf(name, sizeof(name), opt->type == MRB_ZMQ_SOCKOPT_BOOL ? "%s?" : "%s", opt->name);
+      MRB_METHOD_FROM_PROC(method, mrb_proc_new_cfunc_with_env(mrb, mrb_zmq_sockopt_get, 1, &index));
+      mrb_define_method_raw(mrb, zmq_socket_class, mrb_intern_cstr(mrb, name), method);
+      mrb_hash_set(mrb, readable, mrb_symbol_value(mrb_intern_cstr(mrb, opt->name)), index);
+    }
+    if (opt->access & MRB_ZMQ_SOCKOPT_W) {
+      snprintf(name, sizeof(name), "%s=", opt->name);
+      MRB_METHOD_FROM_PROC(method, mrb_proc_new_cfunc_with_env(mrb, mrb_zmq_sockopt_set, 1, &index));
+      mrb_define_method_raw(mrb, zmq_socket_class, mrb_intern_cstr(mrb, name), method);
+    }
+  }
+  mrb_method_t options;
+  MRB_METHOD_FROM_PROC(options, mrb_proc_new_cfunc_with_env(mrb, mrb_zmq_socket_options, 1, &readable));
+  mrb_define_method_raw(mrb, zmq_socket_class, MRB_SYM(options), options);
+}
+
+static mrb_value
+mrb_zmq_setsockopt(mrb_state *mrb, mrb_value self)
+{
+  void *socket;
+  mrb_int option_name;
+  mrb_value option_value;
+  mrb_get_args(mrb, "dio", &socket, &mrb_zmq_socket_type, &option_name, &option_value);
+  mrb_assert_int_fit(mrb_int, option_name, int, INT_MAX);
+
+  int rc = 0;
+
+  switch(mrb_type(option_value)) {
+    case MRB_TT_FALSE: {
+      if (!mrb_integer(option_value)) {
+        rc = zmq_setsockopt(socket, option_name, NULL, 0);
+      } else {
+        int boolean = 0;
+        rc = zmq_setsockopt(socket, option_name, &boolean, sizeof(boolean));
+      }
+    } break;
+    case MRB_TT_TRUE: {
+      int boolean = 1;
+      rc = zmq_setsockopt(socket, option_name, &boolean, sizeof(boolean));
+    } break;
+    case MRB_TT_INTEGER: {
+      int number = (int) mrb_integer(option_value);
+      rc = zmq_setsockopt(socket, option_name, &number, sizeof(number));
+    } break;
+    case MRB_TT_FLOAT: {
+      int64_t number = (int64_t) mrb_float(option_value);
+      rc = zmq_setsockopt(socket, option_name, &number, sizeof(number));
+    } break;
+    case MRB_TT_STRING: {
+      rc = zmq_setsockopt(socket, option_name, RSTRING_PTR(option_value), RSTRING_LEN(option_value));
+    } break;
+    default: {
+      mrb_raise(mrb, E_TYPE_ERROR, "expected nil|false|true|Integer|Float|String as value");
+    }
+  }
+
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_setsockopt");
+  }
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_unbind(mrb_state *mrb, mrb_value self)
+{
+  void *socket;
+  char *endpoint;
+  mrb_get_args(mrb, "dz", &socket, &mrb_zmq_socket_type, &endpoint);
+
+  int rc = zmq_unbind(socket, endpoint);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_unbind");
+  }
+
+  return self;
+}
+
+#ifdef ZMQ_HAS_CAPABILITIES
+static mrb_value
+mrb_zmq_has(mrb_state *mrb, mrb_value self)
+{
+  char *capability;
+  mrb_get_args(mrb, "z", &capability);
+
+  return mrb_bool_value(zmq_has(capability));
+}
+#endif
+
+#ifdef ZMQ_SERVER
+static mrb_value
+mrb_zmq_msg_routing_id(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg;
+  mrb_get_args(mrb, "d", &msg, &mrb_zmq_msg_type);
+
+  return mrb_convert_number(mrb, zmq_msg_routing_id(msg));
+}
+
+static mrb_value
+mrb_zmq_msg_set_routing_id(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg;
+  mrb_int routing_id;
+  mrb_get_args(mrb, "di", &msg, &mrb_zmq_msg_type, &routing_id);
+
+  int rc = zmq_msg_set_routing_id(msg, (uint32_t) routing_id);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_msg_set_routing_id");
+  }
+
+  return self;
+}
+#endif // ZMQ_SERVER
+
+#ifdef ZMQ_DISH
+static mrb_value
+mrb_zmq_join(mrb_state *mrb, mrb_value self)
+{
+  void *socket;
+  char *group;
+  mrb_get_args(mrb, "dz", &socket, &mrb_zmq_socket_type, &group);
+
+  int rc = zmq_join(socket, group);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_join");
+  }
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_leave(mrb_state *mrb, mrb_value self)
+{
+  void *socket;
+  char *group;
+  mrb_get_args(mrb, "dz", &socket, &mrb_zmq_socket_type, &group);
+
+  int rc = zmq_leave(socket, group);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_leave");
+  }
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_msg_group(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg;
+  mrb_get_args(mrb, "d", &msg, &mrb_zmq_msg_type);
+
+  return mrb_str_new_cstr(mrb, zmq_msg_group(msg));
+}
+
+static mrb_value
+mrb_zmq_msg_set_group(mrb_state *mrb, mrb_value self)
+{
+  zmq_msg_t *msg;
+  char *group;
+  mrb_get_args(mrb, "dz", &msg, &mrb_zmq_msg_type, &group);
+
+  int rc = zmq_msg_set_group(msg, group);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_msg_set_group");
+  }
+
+  return self;
+}
+#endif // ZMQ_DISH
+
+static mrb_value
+mrb_zmq_socket(mrb_state *mrb, mrb_value self)
+{
+  if (unlikely(DATA_PTR(self))) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Socket instance already initialized");
+  }
+
+  mrb_int type;
+  const mrb_sym kw_names[] = { MRB_SYM(context), MRB_SYM(affinity) };
+  mrb_value kw_values[NELEMS(kw_names)];
+  mrb_kwargs kwargs;
+  kwargs.num = NELEMS(kw_names);
+  kwargs.required = 0;
+  kwargs.table = kw_names;
+  kwargs.values = kw_values;
+  kwargs.rest = NULL;
+  mrb_get_args(mrb, "i:", &type, &kwargs);
+  mrb_assert_int_fit(mrb_int, type, int, INT_MAX);
+
+  mrb_value context_val = mrb_undef_p(kw_values[0]) ? mrb_nil_value() : kw_values[0];
+  void *context = MRB_LIBZMQ_CONTEXT(mrb);
+  if (!mrb_nil_p(context_val)) {
+    context = mrb_data_get_ptr(mrb, context_val, &mrb_zmq_context_type); // TypeError for anything else
+    if (unlikely(!context)) {
+      mrb_raise(mrb, E_ETERM_ERROR, "ZMQ::Context is closed");
+    }
+  }
+
+  void *socket = zmq_socket(context, (int) type);
+  if (likely(socket)) {
+    mrb_data_init(self, socket, &mrb_zmq_socket_type);
+  } else {
+    mrb_zmq_handle_error(mrb, "zmq_socket");
+  }
+
+  // affinity only affects connections made after it has been set, so it's applied before anything else happens with the socket
+  uint64_t affinity = mrb_zmq_get_state(mrb)->socket_affinity;
+  if (!mrb_undef_p(kw_values[1])) {
+    affinity = (uint64_t) mrb_as_int(mrb, kw_values[1]);
+  }
+  if (affinity) {
+    if (unlikely(-1 == zmq_setsockopt(socket, ZMQ_AFFINITY, &affinity, sizeof(affinity)))) {
+      mrb_zmq_handle_error(mrb, "zmq_setsockopt");
+    }
+  }
+  if (!mrb_nil_p(context_val)) {
+    mrb_iv_set(mrb, self, MRB_SYM(context), context_val);
+  }
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_socket_monitor(mrb_state *mrb, mrb_value self)
+{
+  void *socket;
+  char *addr;
+  mrb_int events;
+  mrb_get_args(mrb, "dzi", &socket, &mrb_zmq_socket_type, &addr, &events);
+  mrb_assert_int_fit(mrb_int, events, int, INT_MAX);
+
+  int rc = zmq_socket_monitor(socket, addr, (int) events);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_socket_monitor");
+  }
+
+  return self;
+}
+
+#ifdef ZMQ_CURRENT_EVENT_VERSION
+static mrb_value
+mrb_zmq_socket_monitor_versioned(mrb_state *mrb, mrb_value self)
+{
+  void *socket;
+  char *addr;
+  mrb_int events, event_version, type = ZMQ_PAIR;
+  mrb_get_args(mrb, "dzii|i", &socket, &mrb_zmq_socket_type, &addr, &events, &event_version, &type);
+  mrb_assert_int_fit(mrb_int, event_version, int, INT_MAX);
+  mrb_assert_int_fit(mrb_int, type, int, INT_MAX);
+
+  int rc = zmq_socket_monitor_versioned(socket, addr, (uint64_t) events, (int) event_version, (int) type);
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_socket_monitor_versioned");
+  }
+
+  return self;
+}
+#endif
+
+MRB_INLINE int
+mrb_zmq_monitor_recv_frame(void *socket, zmq_msg_t *frame)
+{
+  zmq_msg_init(frame);
+  int rc = zmq_msg_recv(frame, socket, 0);
+  if (unlikely(-1 == rc)) {
+    zmq_msg_close(frame);
+  }
+  return rc;
+}
+
+MRB_INLINE uint64_t
+mrb_zmq_monitor_frame_u64(zmq_msg_t *frame)
+{
+  uint64_t value = 0;
+  if (likely(zmq_msg_size(frame) == sizeof(value))) {
+    memcpy(&value, zmq_msg_data(frame), sizeof(value));
+  }
+  zmq_msg_close(frame);
+  return value;
+}
+
+// receives and decodes one monitor event without going through ruby, returns -1 with errno set when nothing was received.
+// Version 1 events are a uint16_t event and uint32_t value followed by the endpoint,
+// version 2 events a uint64_t event, the number of uint64_t values, the values and the local and remote endpoint.
+static int
+mrb_zmq_monitor_event_recv(void *socket, int version, int flags, mrb_zmq_monitor_event_t *event)
+{
+  zmq_msg_t frame;
+  zmq_msg_init(&frame);
+  if (-1 == zmq_msg_recv(&frame, socket, flags)) {
+    zmq_msg_close(&frame);
+    return -1;
+  }
+  event->event = 0;
+  event->value = 0;
+  zmq_msg_init(&event->local);
+  zmq_msg_init(&event->remote);
+
+  // the remaining frames of a event are always queued together with the first one.
+  if (version == 1) {
+    if (likely(zmq_msg_size(&frame) == 6)) {
+      uint16_t event_id;
+      uint32_t value;
+      memcpy(&event_id, zmq_msg_data(&frame), sizeof(event_id));
+      memcpy(&value, (char *) zmq_msg_data(&frame) + sizeof(event_id), sizeof(value));
+      event->event = event_id;
+      event->value = value;
+    }
+    zmq_msg_close(&frame);
+    zmq_msg_recv(&event->local, socket, 0);
+  } else {
+    event->event = mrb_zmq_monitor_frame_u64(&frame);
+    if (likely(mrb_zmq_monitor_recv_frame(socket, &frame) != -1)) {
+      uint64_t values = mrb_zmq_monitor_frame_u64(&frame);
+      for (uint64_t i = 0; i < values && mrb_zmq_monitor_recv_frame(socket, &frame) != -1; i++) {
+        uint64_t value = mrb_zmq_monitor_frame_u64(&frame);
+        if (i == 0) {
+          event->value = value;
+        }
+      }
+    }
+    zmq_msg_recv(&event->local, socket, 0);
+    zmq_msg_recv(&event->remote, socket, 0);
+  }
+
+  return 0;
+}
+
+// Monitor#recv, returns {event:, value:, endpoint:} and with version 2 events also remote_endpoint:
+static mrb_value
+mrb_zmq_monitor_recv(mrb_state *mrb, mrb_value self)
+{
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "|i", &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+
+  void *socket = mrb_data_get_ptr(mrb, mrb_iv_get(mrb, self, MRB_IVSYM(zmq_socket)), &mrb_zmq_socket_type);
+  mrb_value version = mrb_iv_get(mrb, self, MRB_IVSYM(version));
+  int event_version = mrb_integer_p(version) ? (int) mrb_integer(version) : 1;
+
+  mrb_zmq_monitor_event_t event;
+  if (unlikely(-1 == mrb_zmq_monitor_event_recv(socket, event_version, (int) flags, &event))) {
+    mrb_zmq_handle_error(mrb, "zmq_msg_recv");
+  }
+
+  mrb_value event_id = mrb_convert_number(mrb, event.event);
+  mrb_value event_name = mrb_hash_get(mrb, mrb_iv_get(mrb, self, MRB_IVSYM(events)), event_id);
+  mrb_value result = mrb_hash_new_capa(mrb, 4);
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(event)),    mrb_nil_p(event_name) ? event_id : event_name);
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(value)),    mrb_convert_number(mrb, event.value));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(endpoint)), mrb_str_new(mrb, (const char *) zmq_msg_data(&event.local), zmq_msg_size(&event.local)));
+  if (event_version > 1) {
+    mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(remote_endpoint)), mrb_str_new(mrb, (const char *) zmq_msg_data(&event.remote), zmq_msg_size(&event.remote)));
+  }
+  zmq_msg_close(&event.local);
+  zmq_msg_close(&event.remote);
+
+  return result;
+}
+
+static void
+mrb_zmq_monitor_counters_stop(mrb_zmq_monitor_counters_t *counters)
+{
+  if (counters->handle) {
+    counters->stop.store(true, std::memory_order_release);
+    zmq_threadclose(counters->handle);
+    counters->handle = NULL;
+  }
+  if (counters->socket) {
+    int disable = 0;
+    zmq_setsockopt(counters->socket, ZMQ_LINGER, &disable, sizeof(disable));
+    zmq_close(counters->socket);
+    counters->socket = NULL;
+  }
+}
+
+static void
+mrb_zmq_monitor_counters_fn(void *counters_)
+{
+  mrb_zmq_monitor_counters_t *counters = (mrb_zmq_monitor_counters_t *) counters_;
+  mrb_zmq_monitor_event_t event;
+
+  while (!counters->stop.load(std::memory_order_acquire)) {
+    if (-1 == mrb_zmq_monitor_event_recv(counters->socket, counters->version, 0, &event)) {
+      if (zmq_errno() == EAGAIN || zmq_errno() == EINTR) {
+        continue;
+      }
+      break;
+    }
+    std::string endpoint((const char *) zmq_msg_data(&event.local), zmq_msg_size(&event.local));
+    zmq_msg_close(&event.local);
+    zmq_msg_close(&event.remote);
+    {
+      std::lock_guard<std::mutex> lock(counters->mutex);
+      counters->counts[std::make_pair(event.event, endpoint)]++;
+    }
+    if (event.event == ZMQ_EVENT_MONITOR_STOPPED) {
+      break;
+    }
+  }
+}
+
+// takes over the monitor pipe and counts its events on a native thread, no event reaches ruby.
+static mrb_value
+mrb_zmq_monitor_counters_new(mrb_state *mrb, mrb_value self)
+{
+  if (unlikely(DATA_PTR(self))) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Socket::Monitor::Counters instance already initialized");
+  }
+
+  mrb_value socket_val;
+  mrb_int version;
+  mrb_get_args(mrb, "oi", &socket_val, &version);
+
+  mrb_zmq_monitor_counters_t *counters = new mrb_zmq_monitor_counters_t();
+  counters->stop = false;
+  counters->version = (int) version;
+  mrb_data_init(self, counters, &mrb_zmq_monitor_counters_type);
+
+  counters->socket = mrb_zmq_take_socket(mrb, socket_val);
+  int timeout = MRB_ZMQ_MONITOR_COUNTERS_IVL;
+  zmq_setsockopt(counters->socket, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+  counters->handle = zmq_threadstart(mrb_zmq_monitor_counters_fn, counters);
+  if (unlikely(!counters->handle)) {
+    mrb_zmq_handle_error(mrb, "zmq_threadstart");
+  }
+  mrb_hash_set(mrb, mrb_zmq_get_state(mrb)->monitor_counters, mrb_zmq_ptr_key(mrb, counters), self);
+
+  return self;
+}
+
+// returns {event => {endpoint => count}}
+static mrb_value
+mrb_zmq_monitor_counters_to_h(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_monitor_counters_t *counters = (mrb_zmq_monitor_counters_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_monitor_counters_type);
+  mrb_value result = mrb_hash_new(mrb);
+  if (unlikely(!counters)) {
+    return result;
+  }
+
+  std::lock_guard<std::mutex> lock(counters->mutex);
+  for (const auto &count : counters->counts) {
+    mrb_value event = mrb_convert_number(mrb, count.first.first);
+    mrb_value endpoints = mrb_hash_get(mrb, result, event);
+    if (mrb_nil_p(endpoints)) {
+      endpoints = mrb_hash_new(mrb);
+      mrb_hash_set(mrb, result, event, endpoints);
+    }
+    mrb_hash_set(mrb, endpoints, mrb_str_new(mrb, count.first.second.data(), count.first.second.size()), mrb_convert_number(mrb, count.second));
+  }
+
+  return result;
+}
+
+static mrb_value
+mrb_zmq_monitor_counters_stop_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_monitor_counters_t *counters = (mrb_zmq_monitor_counters_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_monitor_counters_type);
+  if (counters) {
+    mrb_zmq_monitor_counters_stop(counters);
+    mrb_hash_delete_key(mrb, mrb_zmq_get_state(mrb)->monitor_counters, mrb_zmq_ptr_key(mrb, counters));
+  }
+
+  return mrb_nil_value();
+}
+
+static void
+mrb_zmq_logger_flush(mrb_zmq_logger_t *logger)
+{
+  std::lock_guard<std::mutex> write_lock(logger->write_mutex);
+  size_t count;
+  {
+    std::lock_guard<std::mutex> lock(logger->mutex);
+    count = logger->used;
+    if (count == 0) {
+      return;
+    }
+    logger->pending.swap(logger->writing);
+    logger->used = 0;
+  }
+
+  std::string &frame = logger->frame;
+  frame.clear();
+  for (size_t i = 0; i < count; i++) {
+    mrb_zmq_logger_entry_t &entry = logger->writing[i];
+    if (entry.time != logger->formatted_at) {
+      struct tm tm;
+      gmtime_r(&entry.time, &tm);
+      strftime(logger->formatted, sizeof(logger->formatted), "%Y-%m-%d %H:%M:%S UTC", &tm);
+      logger->formatted_at = entry.time;
+    }
+    frame.push_back(entry.level);
+    frame.append(", ");
+    if (!logger->ident.empty()) {
+      frame.append(logger->ident);
+      frame.append(", ");
+    }
+    frame.append(logger->formatted);
+    frame.append(", ");
+    frame.append(entry.message);
+    frame.push_back('\n');
+  }
+
+  if (logger->stdout_) {
+    fwrite(frame.data(), 1, frame.size(), stdout);
+    fflush(stdout);
+  }
+  // the trailing newline is only for stdout
+  if (logger->socket && zmq_send(logger->socket, frame.data(), frame.size() - 1, ZMQ_DONTWAIT) == -1) {
+    logger->dropped.fetch_add(count, std::memory_order_relaxed);
+  } else {
+    logger->written.fetch_add(count, std::memory_order_relaxed);
+  }
+  logger->batches.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void
+mrb_zmq_logger_fn(void *logger_)
+{
+  mrb_zmq_logger_t *logger = (mrb_zmq_logger_t *) logger_;
+  bool stop = false;
+  while (!stop) {
+    {
+      std::unique_lock<std::mutex> lock(logger->mutex);
+      logger->wakeup.wait_for(lock, std::chrono::milliseconds(logger->interval), [logger] {
+        return logger->stop || logger->used >= logger->batch;
+      });
+      stop = logger->stop;
+    }
+    mrb_zmq_logger_flush(logger);
+  }
+}
+
+// writes what is still queued and closes the socket, the logger drops everything afterwards.
+static void
+mrb_zmq_logger_stop(mrb_zmq_logger_t *logger)
+{
+  if (logger->handle) {
+    {
+      std::lock_guard<std::mutex> lock(logger->mutex);
+      logger->stop = true;
+    }
+    logger->wakeup.notify_one();
+    zmq_threadclose(logger->handle);
+    logger->handle = NULL;
+  }
+  mrb_zmq_logger_flush(logger);
+  logger->closed = true;
+  if (logger->socket) {
+    int disable = 0;
+    zmq_setsockopt(logger->socket, ZMQ_LINGER, &disable, sizeof(disable));
+    zmq_close(logger->socket);
+    logger->socket = NULL;
+  }
+}
+
+// loggers always use the default context
+static void
+mrb_zmq_loggers_stop(mrb_state *mrb, mrb_zmq_state_t *state)
+{
+  mrb_value loggers = mrb_hash_values(mrb, state->loggers);
+  for (mrb_int i = 0; i < RARRAY_LEN(loggers); i++) {
+    mrb_zmq_logger_stop((mrb_zmq_logger_t *) DATA_PTR(mrb_ary_ref(mrb, loggers, i)));
+  }
+  mrb_hash_clear(mrb, state->loggers);
+}
+
+static mrb_value
+mrb_zmq_logger_new(mrb_state *mrb, mrb_value self)
+{
+  if (unlikely(DATA_PTR(self))) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Logger::Buffer instance already initialized");
+  }
+
+  mrb_value pub_val, ident_val;
+  mrb_int interval = MRB_ZMQ_LOGGER_INTERVAL, batch = MRB_ZMQ_LOGGER_BATCH, capacity = MRB_ZMQ_LOGGER_CAPACITY;
+  mrb_bool stdout_ = TRUE;
+  mrb_get_args(mrb, "oo|iiib", &pub_val, &ident_val, &interval, &batch, &capacity, &stdout_);
+  if (unlikely(interval < 1 || batch < 1 || capacity < 1)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "interval, batch and capacity must be positive");
+  }
+  mrb_assert_int_fit(mrb_int, interval, int, INT_MAX);
+
+  mrb_zmq_logger_t *logger = new mrb_zmq_logger_t();
+  logger->stdout_ = stdout_;
+  logger->interval = (int) interval;
+  logger->batch = (size_t) batch;
+  logger->pending.resize((size_t) capacity);
+  logger->writing.resize((size_t) capacity);
+  logger->written = logger->dropped = logger->batches = 0;
+  mrb_data_init(self, logger, &mrb_zmq_logger_type);
+
+  if (!mrb_nil_p(ident_val)) {
+    logger->ident = mrb_string_value_cstr(mrb, &ident_val);
+  }
+  if (!mrb_nil_p(pub_val)) {
+    logger->socket = mrb_zmq_take_socket(mrb, pub_val);
+#ifdef ZMQ_XPUB_NODROP
+    // makes the pub socket report a full queue, so those batches are counted as dropped
+    int enable = 1;
+    zmq_setsockopt(logger->socket, ZMQ_XPUB_NODROP, &enable, sizeof(enable));
+#endif
+    // the socket has to be closed before the context is terminated, even when nothing is ever logged.
+    mrb_hash_set(mrb, mrb_zmq_get_state(mrb)->loggers, mrb_zmq_ptr_key(mrb, logger), self);
+  }
+
+  return self;
+}
+
+// queues one entry, formatting and writing happens on the flush thread.
+// returns false when the entry was dropped because the buffer is full or closed.
+static mrb_value
+mrb_zmq_logger_push(mrb_state *mrb, mrb_value self)
+{
+  mrb_int level;
+  mrb_value message;
+  mrb_get_args(mrb, "io", &level, &message);
+  mrb_zmq_logger_t *logger = (mrb_zmq_logger_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_logger_type);
+  if (unlikely(!logger)) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Logger::Buffer not initialized");
+  }
+  static const char levels[] = "DIWE";
+  if (unlikely(level < 0 || level > 3)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "unknown log level");
+  }
+  message = mrb_obj_as_string(mrb, message);
+
+  if (unlikely(logger->closed)) {
+    logger->dropped.fetch_add(1, std::memory_order_relaxed);
+    return mrb_false_value();
+  }
+  if (unlikely(!logger->handle)) {
+    logger->handle = zmq_threadstart(mrb_zmq_logger_fn, logger);
+    if (unlikely(!logger->handle)) {
+      mrb_zmq_handle_error(mrb, "zmq_threadstart");
+    }
+    mrb_hash_set(mrb, mrb_zmq_get_state(mrb)->loggers, mrb_zmq_ptr_key(mrb, logger), self);
+  }
+
+  bool wakeup;
+  {
+    std::lock_guard<std::mutex> lock(logger->mutex);
+    if (unlikely(logger->used == logger->pending.size())) {
+      logger->dropped.fetch_add(1, std::memory_order_relaxed);
+      return mrb_false_value();
+    }
+    mrb_zmq_logger_entry_t &entry = logger->pending[logger->used++];
+    entry.level = levels[level];
+    entry.time = time(NULL);
+    entry.message.assign(RSTRING_PTR(message), RSTRING_LEN(message));
+    wakeup = logger->used == logger->batch;
+  }
+  if (wakeup) {
+    logger->wakeup.notify_one();
+  }
+
+  return mrb_true_value();
+}
+
+static mrb_value
+mrb_zmq_logger_flush_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_logger_t *logger = (mrb_zmq_logger_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_logger_type);
+  if (logger) {
+    mrb_zmq_logger_flush(logger);
+  }
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_logger_stats(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_logger_t *logger = (mrb_zmq_logger_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_logger_type);
+  if (unlikely(!logger)) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Logger::Buffer not initialized");
+  }
+  size_t queued;
+  {
+    std::lock_guard<std::mutex> lock(logger->mutex);
+    queued = logger->used;
+  }
+
+  mrb_value stats = mrb_hash_new_capa(mrb, 4);
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(queued)),  mrb_convert_number(mrb, queued));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(written)), mrb_convert_number(mrb, logger->written.load(std::memory_order_relaxed)));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(dropped)), mrb_convert_number(mrb, logger->dropped.load(std::memory_order_relaxed)));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(batches)), mrb_convert_number(mrb, logger->batches.load(std::memory_order_relaxed)));
+
+  return stats;
+}
+
+static mrb_value
+mrb_zmq_logger_close(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_logger_t *logger = (mrb_zmq_logger_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_logger_type);
+  if (logger) {
+    mrb_zmq_logger_stop(logger);
+    mrb_hash_delete_key(mrb, mrb_zmq_get_state(mrb)->loggers, mrb_zmq_ptr_key(mrb, logger));
+  }
+
+  return mrb_nil_value();
+}
+
+static void
+mrb_zmq_zap_close_frames(mrb_zmq_zap_t *zap)
+{
+  for (int i = 0; i < zap->nframes; i++) {
+    zmq_msg_close(&zap->frames[i]);
+  }
+  zap->nframes = 0;
+}
+
+static mrb_value
+mrb_zmq_zap_setup(mrb_state *mrb, mrb_value self)
+{
+  if (unlikely(DATA_PTR(self))) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Zap instance already initialized");
+  }
+  mrb_int cache_max = MRB_ZMQ_ZAP_CACHE_SIZE;
+  mrb_get_args(mrb, "|i", &cache_max);
+  if (unlikely(cache_max < 0)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "cache size must not be negative");
+  }
+
+  mrb_zmq_zap_t *zap = new mrb_zmq_zap_t();
+  zap->cache_max = (size_t) cache_max;
+  mrb_data_init(self, zap, &mrb_zmq_zap_type);
+
+  return self;
+}
+
+// replaces the allowlist, takes {z85 or binary public key => user id} and {username => password}.
+// Cached decisions may be outdated afterwards, so the cache gets cleared too.
+static mrb_value
+mrb_zmq_zap_set_allowlist(mrb_state *mrb, mrb_value self)
+{
+  mrb_value curve_val, plain_val;
+  mrb_get_args(mrb, "HH", &curve_val, &plain_val);
+  mrb_zmq_zap_t *zap = (mrb_zmq_zap_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_zap_type);
+
+  std::unordered_map<std::string, std::string> curve, plain;
+  mrb_value keys = mrb_hash_keys(mrb, curve_val);
+  for (mrb_int i = 0; i < RARRAY_LEN(keys); i++) {
+    mrb_value key = mrb_ary_ref(mrb, keys, i);
+    mrb_value user = mrb_obj_as_string(mrb, mrb_hash_get(mrb, curve_val, key));
+    key = mrb_str_to_str(mrb, key);
+    std::string public_key;
+    if (RSTRING_LEN(key) == 40) {
+      public_key.resize(32);
+      if (unlikely(!zmq_z85_decode((uint8_t *) &public_key[0], mrb_string_value_cstr(mrb, &key)))) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid z85 encoded curve key");
+      }
+    } else if (RSTRING_LEN(key) == 32) {
+      public_key.assign(RSTRING_PTR(key), 32);
+    } else {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "curve keys must be 32 bytes or 40 z85 characters long");
+    }
+    curve[public_key] = std::string(RSTRING_PTR(user), RSTRING_LEN(user));
+  }
+  keys = mrb_hash_keys(mrb, plain_val);
+  for (mrb_int i = 0; i < RARRAY_LEN(keys); i++) {
+    mrb_value username = mrb_obj_as_string(mrb, mrb_ary_ref(mrb, keys, i));
+    mrb_value password = mrb_obj_as_string(mrb, mrb_hash_get(mrb, plain_val, mrb_ary_ref(mrb, keys, i)));
+    plain[std::string(RSTRING_PTR(username), RSTRING_LEN(username))] = std::string(RSTRING_PTR(password), RSTRING_LEN(password));
+  }
+
+  zap->curve.swap(curve);
+  zap->plain.swap(plain);
+  zap->lru.clear();
+  zap->cache.clear();
+
+  return self;
+}
+
+MRB_INLINE bool
+mrb_zmq_zap_frame_eq(zmq_msg_t *frame, const char *str, size_t len)
+{
+  return zmq_msg_size(frame) == len && memcmp(zmq_msg_data(frame), str, len) == 0;
+}
+
+MRB_INLINE mrb_value
+mrb_zmq_zap_frame_str(mrb_state *mrb, zmq_msg_t *frame)
+{
+  return mrb_str_new(mrb, (const char *) zmq_msg_data(frame), zmq_msg_size(frame));
+}
+
+static void
+mrb_zmq_zap_append_metadata(mrb_state *mrb, std::string &metadata, mrb_value key, mrb_value value)
+{
+  key = mrb_obj_as_string(mrb, key);
+  value = mrb_obj_as_string(mrb, value);
+  if (unlikely(RSTRING_LEN(key) > 255)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "metadata keys can only be 8 bit long");
+  }
+  metadata.push_back((char) RSTRING_LEN(key));
+  metadata.append(RSTRING_PTR(key), RSTRING_LEN(key));
+  uint32_t value_len = (uint32_t) RSTRING_LEN(value);
+  metadata.push_back((char) (value_len >> 24));
+  metadata.push_back((char) (value_len >> 16));
+  metadata.push_back((char) (value_len >> 8));
+  metadata.push_back((char) value_len);
+  metadata.append(RSTRING_PTR(value), RSTRING_LEN(value));
+}
+
+// asks the ruby authenticator through Zap#__authenticate__, which returns [status, user, metadata]
+static void
+mrb_zmq_zap_authenticate(mrb_state *mrb, mrb_value self, mrb_zmq_zap_t *zap, mrb_zmq_zap_decision_t *decision)
+{
+  mrb_value argv[MRB_ZMQ_ZAP_FRAMES - 4];
+  mrb_int argc = 0;
+  for (int i = 4; i < zap->nframes; i++) {
+    argv[argc++] = mrb_zmq_zap_frame_str(mrb, &zap->frames[i]);
+  }
+  zap->authenticator_calls++;
+  mrb_value result = mrb_funcall_argv(mrb, self, MRB_SYM(__authenticate__), argc, argv);
+  mrb_value status = mrb_ary_ref(mrb, result, 0);
+  decision->status = mrb_integer_p(status) ? (int) mrb_integer(status) : 300;
+  if (decision->status != 200) {
+    return;
+  }
+
+  mrb_value user = mrb_obj_as_string(mrb, mrb_ary_ref(mrb, result, 1));
+  decision->user.assign(RSTRING_PTR(user), RSTRING_LEN(user));
+  mrb_value metadata = mrb_ary_ref(mrb, result, 2);
+  if (mrb_hash_p(metadata)) {
+    mrb_value keys = mrb_hash_keys(mrb, metadata);
+    for (mrb_int i = 0; i < RARRAY_LEN(keys); i++) {
+      mrb_value key = mrb_ary_ref(mrb, keys, i);
+      mrb_zmq_zap_append_metadata(mrb, decision->metadata, key, mrb_hash_get(mrb, metadata, key));
+    }
+  } else if (mrb_array_p(metadata)) {
+    for (mrb_int i = 0; i < RARRAY_LEN(metadata); i++) {
+      mrb_value pair = mrb_ary_ref(mrb, metadata, i);
+      mrb_zmq_zap_append_metadata(mrb, decision->metadata, mrb_ary_ref(mrb, pair, 0), mrb_ary_ref(mrb, pair, 1));
+    }
+  }
+}
+
+static void
+mrb_zmq_zap_reply(mrb_state *mrb, void *socket, mrb_zmq_zap_t *zap, const mrb_zmq_zap_decision_t *decision)
+{
+  const char *status_text;
+  switch (decision->status) {
+    case 200: status_text = "OK"; break;
+    case 400: status_text = "Invalid credentials"; break;
+    case 500: status_text = "Version number not valid"; break;
+    default:  status_text = "Temporary Error";
+  }
+  char status_code[12];
+  int status_len = snprintf(status_code, sizeof(status_code), "%d", decision->status);
+
+  if (unlikely(zmq_msg_send(&zap->frames[0], socket, ZMQ_SNDMORE) == -1 ||
+    zmq_msg_send(&zap->frames[1], socket, ZMQ_SNDMORE) == -1 ||
+    zmq_send(socket, "1.0", 3, ZMQ_SNDMORE) == -1 ||
+    zmq_msg_send(&zap->frames[3], socket, ZMQ_SNDMORE) == -1 ||
+    zmq_send(socket, status_code, status_len, ZMQ_SNDMORE) == -1 ||
+    zmq_send(socket, status_text, strlen(status_text), ZMQ_SNDMORE) == -1 ||
+    zmq_send(socket, decision->user.data(), decision->user.size(), ZMQ_SNDMORE) == -1 ||
+    zmq_send(socket, decision->metadata.data(), decision->metadata.size(), 0) == -1)) {
+    mrb_zmq_handle_error(mrb, "zmq_send");
+  }
+}
+
+// receives one zap request and answers it, the allowlist and the cache are checked before the ruby authenticator.
+static mrb_value
+mrb_zmq_zap_handle(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_zap_t *zap = (mrb_zmq_zap_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_zap_type);
+  if (unlikely(!zap)) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Zap not initialized");
+  }
+  void *socket = mrb_data_get_ptr(mrb, mrb_iv_get(mrb, self, MRB_IVSYM(zmq_socket)), &mrb_zmq_socket_type);
+
+  // frames left over from a request which raised are closed here
+  mrb_zmq_zap_close_frames(zap);
+  int more = 1;
+  bool overflow = false;
+  while (more) {
+    zmq_msg_t *frame = &zap->frames[zap->nframes < MRB_ZMQ_ZAP_FRAMES ? zap->nframes : MRB_ZMQ_ZAP_FRAMES - 1];
+    if (zap->nframes >= MRB_ZMQ_ZAP_FRAMES) {
+      // too many frames, the last one is overwritten and the request gets rejected below
+      zmq_msg_close(frame);
+      zap->nframes--;
+      overflow = true;
+    }
+    zmq_msg_init(frame);
+    zap->nframes++;
+    if (unlikely(zmq_msg_recv(frame, socket, 0) == -1)) {
+      mrb_zmq_handle_error(mrb, "zmq_msg_recv");
+    }
+    more = zmq_msg_more(frame);
+  }
+  if (unlikely(zap->nframes < 8)) {
+    // not a zap request, there is nothing to reply to
+    mrb_zmq_zap_close_frames(zap);
+    return mrb_nil_value();
+  }
+
+  zap->handshakes++;
+  time_t now = time(NULL);
+  if (now != zap->second) {
+    zap->last_second = now == zap->second + 1 ? zap->this_second : 0;
+    zap->second = now;
+    zap->this_second = 0;
+  }
+  zap->this_second++;
+
+  zmq_msg_t *mechanism = &zap->frames[7];
+  mrb_zmq_zap_decision_t decision;
+  decision.status = 0;
+  if (unlikely(!mrb_zmq_zap_frame_eq(&zap->frames[2], "1.0", 3))) {
+    decision.status = 500;
+  } else if (unlikely(overflow)) {
+    decision.status = 400;
+  } else if (mrb_zmq_zap_frame_eq(mechanism, "CURVE", 5) && zap->nframes == 9 && zmq_msg_size(&zap->frames[8]) == 32) {
+    auto it = zap->curve.find(std::string((const char *) zmq_msg_data(&zap->frames[8]), 32));
+    if (it != zap->curve.end()) {
+      decision.status = 200;
+      decision.user = it->second;
+    }
+  } else if (mrb_zmq_zap_frame_eq(mechanism, "PLAIN", 5) && zap->nframes == 10) {
+    auto it = zap->plain.find(std::string((const char *) zmq_msg_data(&zap->frames[8]), zmq_msg_size(&zap->frames[8])));
+    if (it != zap->plain.end() && mrb_zmq_zap_frame_eq(&zap->frames[9], it->second.data(), it->second.size())) {
+      decision.status = 200;
+      decision.user = it->first;
+    }
+  }
+
+  if (decision.status != 0) {
+    if (decision.status == 200) {
+      zap->allowlist_hits++;
+    }
+    mrb_zmq_zap_reply(mrb, socket, zap, &decision);
+    mrb_zmq_zap_close_frames(zap);
+    return mrb_nil_value();
+  }
+
+  // domain, address, identity, mechanism and credentials, each prefixed by their size
+  std::string &key = zap->key;
+  key.clear();
+  for (int i = 4; i < zap->nframes; i++) {
+    uint32_t size = (uint32_t) zmq_msg_size(&zap->frames[i]);
+    key.append((const char *) &size, sizeof(size));
+    key.append((const char *) zmq_msg_data(&zap->frames[i]), size);
+  }
+
+  auto cached = zap->cache.find(key);
+  if (cached != zap->cache.end()) {
+    zap->cache_hits++;
+    zap->lru.splice(zap->lru.begin(), zap->lru, cached->second);
+    mrb_zmq_zap_reply(mrb, socket, zap, &cached->second->second);
+    mrb_zmq_zap_close_frames(zap);
+    return mrb_nil_value();
+  }
+
+  mrb_zmq_zap_authenticate(mrb, self, zap, &decision);
+  mrb_zmq_zap_reply(mrb, socket, zap, &decision);
+  mrb_zmq_zap_close_frames(zap);
+
+  // temporary errors are retried on the next handshake
+  if (zap->cache_max > 0 && (decision.status == 200 || decision.status == 400)) {
+    zap->lru.emplace_front(key, decision);
+    zap->cache[key] = zap->lru.begin();
+    if (zap->lru.size() > zap->cache_max) {
+      zap->cache.erase(zap->lru.back().first);
+      zap->lru.pop_back();
+    }
+  }
+
+  return mrb_nil_value();
+}
+
+static mrb_value
+mrb_zmq_zap_clear_cache(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_zap_t *zap = (mrb_zmq_zap_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_zap_type);
+  zap->lru.clear();
+  zap->cache.clear();
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_zap_stats(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_zap_t *zap = (mrb_zmq_zap_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_zap_type);
+  // the rate of the last complete second, which is 0 when nothing happened in it
+  time_t now = time(NULL);
+  uint64_t per_second = now == zap->second ? zap->last_second : (now == zap->second + 1 ? zap->this_second : 0);
+
+  mrb_value stats = mrb_hash_new_capa(mrb, 6);
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(handshakes)),            mrb_convert_number(mrb, zap->handshakes));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(handshakes_per_second)), mrb_convert_number(mrb, per_second));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(allowlist_hits)),        mrb_convert_number(mrb, zap->allowlist_hits));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(cache_hits)),            mrb_convert_number(mrb, zap->cache_hits));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(authenticator_calls)),   mrb_convert_number(mrb, zap->authenticator_calls));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(cache_size)),            mrb_convert_number(mrb, zap->lru.size()));
+
+  return stats;
+}
+
+#ifdef MRB_ZMQ_STATS
+// {count:, min:, max:, mean:, p50:, p90:, p99:, p999:} in nanoseconds, percentiles are the lower bound of their bucket
+static mrb_value
+mrb_zmq_histogram_to_h(mrb_state *mrb, const mrb_zmq_histogram_t *histogram)
+{
+  mrb_value result = mrb_hash_new_capa(mrb, 8);
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(count)), mrb_convert_number(mrb, histogram->count));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(min)),   mrb_convert_number(mrb, histogram->min));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(max)),   mrb_convert_number(mrb, histogram->max));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(mean)),  mrb_convert_number(mrb, histogram->count ? histogram->sum / histogram->count : 0));
+
+  static const struct { mrb_sym name; uint64_t per_mille; } percentiles[] = {
+    { MRB_SYM(p50), 500 }, { MRB_SYM(p90), 900 }, { MRB_SYM(p99), 990 }, { MRB_SYM(p999), 999 }
+  };
+  int bucket = 0;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < NELEMS(percentiles); i++) {
+    uint64_t rank = (histogram->count * percentiles[i].per_mille + 999) / 1000;
+    while (bucket < MRB_ZMQ_HISTOGRAM_BUCKETS - 1 && seen + histogram->buckets[bucket] < rank) {
+      seen += histogram->buckets[bucket++];
     }
+    uint64_t value = histogram->count ? mrb_zmq_histogram_bucket_value(bucket) : 0;
+    if (value < histogram->min) {
+      value = histogram->min;
+    }
+    mrb_hash_set(mrb, result, mrb_symbol_value(percentiles[i].name), mrb_convert_number(mrb, value));
   }
 
-  if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_setsockopt");
-  }
+  return result;
+}
 
-  return self;
+static mrb_value
+mrb_zmq_socket_stats_to_h(mrb_state *mrb, const mrb_zmq_socket_stats_t *stats)
+{
+  mrb_value result = mrb_hash_new_capa(mrb, 8);
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(msgs_out)),  mrb_convert_number(mrb, stats->msgs_out));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(bytes_out)), mrb_convert_number(mrb, stats->bytes_out));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(msgs_in)),   mrb_convert_number(mrb, stats->msgs_in));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(bytes_in)),  mrb_convert_number(mrb, stats->bytes_in));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(eagain)),    mrb_convert_number(mrb, stats->eagain));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(eterm)),     mrb_convert_number(mrb, stats->eterm));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(errors)),    mrb_convert_number(mrb, stats->errors));
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(recv_wait)), mrb_zmq_histogram_to_h(mrb, &stats->recv_wait));
+
+  return result;
 }
 
 static mrb_value
-mrb_zmq_unbind(mrb_state *mrb, mrb_value self)
+mrb_zmq_socket_stats_m(mrb_state *mrb, mrb_value self)
 {
-  void *socket;
-  char *endpoint;
-  mrb_get_args(mrb, "dz", &socket, &mrb_zmq_socket_type, &endpoint);
+  return mrb_zmq_socket_stats_to_h(mrb, mrb_zmq_socket_stats(mrb, self));
+}
 
-  int rc = zmq_unbind(socket, endpoint);
-  if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_unbind");
+// like Socket#stats, but nil for sockets which never sent or received anything
+static mrb_value
+mrb_zmq_socket_stats_active(mrb_state *mrb, mrb_value self)
+{
+  mrb_value stats_val = mrb_iv_get(mrb, self, MRB_SYM(stats));
+  if (!mrb_data_p(stats_val)) {
+    return mrb_nil_value();
   }
 
-  return self;
+  return mrb_zmq_socket_stats_to_h(mrb, (mrb_zmq_socket_stats_t *) DATA_PTR(stats_val));
 }
 
-#ifdef ZMQ_HAS_CAPABILITIES
 static mrb_value
-mrb_zmq_has(mrb_state *mrb, mrb_value self)
+mrb_zmq_poller_stats(mrb_state *mrb, mrb_value self)
 {
-  char *capability;
-  mrb_get_args(mrb, "z", &capability);
+  mrb_value result = mrb_hash_new_capa(mrb, 1);
+  mrb_hash_set(mrb, result, mrb_symbol_value(MRB_SYM(wait)), mrb_zmq_histogram_to_h(mrb, &mrb_zmq_get_state(mrb)->poll_wait));
 
-  return mrb_bool_value(zmq_has(capability));
+  return result;
 }
 #endif
 
-#ifdef ZMQ_SERVER
-static mrb_value
-mrb_zmq_msg_routing_id(mrb_state *mrb, mrb_value self)
+// receives one logical message, a ZMQ::Msg or a Array of them when it has multiple parts.
+// returns -1 and leaves errno alone when a part couldn't be received, parts received before are dropped then.
+// Nothing gets allocated until a part arrived so a EAGAIN is cheap.
+static int
+mrb_zmq_recv_message(mrb_state *mrb, void *socket, struct RClass *zmq_msg_class, int flags, mrb_value *data)
 {
-  zmq_msg_t *msg;
-  mrb_get_args(mrb, "d", &msg, &mrb_zmq_msg_type);
+  int more;
+  *data = mrb_nil_value();
 
-  return mrb_convert_number(mrb, zmq_msg_routing_id(msg));
+  do {
+    zmq_msg_t frame;
+    zmq_msg_init(&frame);
+    int rc = zmq_msg_recv(&frame, socket, flags);
+    if (unlikely(-1 == rc)) {
+      return -1;
+    }
+
+    mrb_value msg_val = mrb_obj_value(mrb_data_object_alloc(mrb, zmq_msg_class, NULL, NULL));
+    zmq_msg_t *msg = mrb_zmq_msg_alloc(mrb);
+    zmq_msg_init(msg);
+    mrb_data_init(msg_val, msg, &mrb_zmq_msg_type);
+    zmq_msg_move(msg, &frame);
+    mrb_zmq_msg_account(mrb, msg);
+    more = zmq_msg_more(msg);
+    if (more) {
+      if (!mrb_array_p(*data)) {
+        *data = mrb_ary_new_capa(mrb, 2); // We have at least two zmq messages at this point.
+      }
+      mrb_ary_push(mrb, *data, msg_val);
+    } else {
+      if (mrb_array_p(*data)) {
+        mrb_ary_push(mrb, *data, msg_val);
+      } else {
+        *data = msg_val;
+      }
+    }
+  } while (more);
+
+  return 0;
 }
 
 static mrb_value
-mrb_zmq_msg_set_routing_id(mrb_state *mrb, mrb_value self)
+mrb_zmq_socket_recv(mrb_state *mrb, mrb_value self)
 {
-  zmq_msg_t *msg;
-  mrb_int routing_id;
-  mrb_get_args(mrb, "di", &msg, &mrb_zmq_msg_type, &routing_id);
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "|i", &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
 
-  int rc = zmq_msg_set_routing_id(msg, (uint32_t) routing_id);
+  mrb_value data;
+  struct RClass *zmq_msg_class = mrb_zmq_get_state(mrb)->zmq_msg_class;
+  void *socket = mrb_data_get_ptr(mrb, self, &mrb_zmq_socket_type);
+
+  MRB_ZMQ_STATS_CLOCK(started);
+  int rc = mrb_zmq_recv_message(mrb, socket, zmq_msg_class, (int) flags, &data);
+  MRB_ZMQ_STATS_RECEIVED(mrb, self, rc, data, started);
   if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_msg_set_routing_id");
+    mrb_zmq_handle_error(mrb, "zmq_msg_recv");
   }
 
-  return self;
+  return data;
 }
-#endif // ZMQ_SERVER
 
-#ifdef ZMQ_DISH
+// like recv with DONTWAIT, but returns nil instead of raising when nothing is queued.
 static mrb_value
-mrb_zmq_join(mrb_state *mrb, mrb_value self)
+mrb_zmq_socket_try_recv(mrb_state *mrb, mrb_value self)
 {
-  void *socket;
-  char *group;
-  mrb_get_args(mrb, "dz", &socket, &mrb_zmq_socket_type, &group);
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "|i", &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
 
-  int rc = zmq_join(socket, group);
+  mrb_value data;
+  struct RClass *zmq_msg_class = mrb_zmq_get_state(mrb)->zmq_msg_class;
+  void *socket = mrb_data_get_ptr(mrb, self, &mrb_zmq_socket_type);
+
+  MRB_ZMQ_STATS_CLOCK(started);
+  int rc = mrb_zmq_recv_message(mrb, socket, zmq_msg_class, (int) flags | ZMQ_DONTWAIT, &data);
+  MRB_ZMQ_STATS_RECEIVED(mrb, self, rc, data, started);
   if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_join");
+    if (likely(mrb_zmq_errno() == EAGAIN)) {
+      return mrb_nil_value();
+    }
+    mrb_zmq_handle_error(mrb, "zmq_msg_recv");
   }
 
-  return self;
+  return data;
 }
 
+// receives up to max messages, only the first receive may block.
+// Stops early once the socket has nothing more queued.
 static mrb_value
-mrb_zmq_leave(mrb_state *mrb, mrb_value self)
+mrb_zmq_socket_recv_many(mrb_state *mrb, mrb_value self)
 {
-  void *socket;
-  char *group;
-  mrb_get_args(mrb, "dz", &socket, &mrb_zmq_socket_type, &group);
+  mrb_int max, flags = 0;
+  mrb_get_args(mrb, "i|i", &max, &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+  if (unlikely(max <= 0)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "max must be greater than 0");
+  }
 
-  int rc = zmq_leave(socket, group);
+  struct RClass *zmq_msg_class = mrb_zmq_get_state(mrb)->zmq_msg_class;
+  void *socket = mrb_data_get_ptr(mrb, self, &mrb_zmq_socket_type);
+  mrb_value messages = mrb_ary_new_capa(mrb, max < 64 ? max : 64);
+  int ai = mrb_gc_arena_save(mrb);
+
+  mrb_value data;
+  MRB_ZMQ_STATS_CLOCK(started);
+  int rc = mrb_zmq_recv_message(mrb, socket, zmq_msg_class, (int) flags, &data);
+  MRB_ZMQ_STATS_RECEIVED(mrb, self, rc, data, started);
   if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_leave");
+    mrb_zmq_handle_error(mrb, "zmq_msg_recv");
+  }
+  mrb_ary_push(mrb, messages, data);
+  mrb_gc_arena_restore(mrb, ai);
+
+  for (mrb_int i = 1; i < max; i++) {
+    // messages we already received would get lost if we raised here, so the batch ends
+    // and a error which persists shows up on the next call.
+    MRB_ZMQ_STATS_CLOCK(next_started);
+    if (-1 == mrb_zmq_recv_message(mrb, socket, zmq_msg_class, (int) flags | ZMQ_DONTWAIT, &data)) {
+      break;
+    }
+    MRB_ZMQ_STATS_RECEIVED(mrb, self, 0, data, next_started);
+    mrb_ary_push(mrb, messages, data);
+    mrb_gc_arena_restore(mrb, ai);
   }
 
-  return self;
+  return messages;
 }
 
-static mrb_value
-mrb_zmq_msg_group(mrb_state *mrb, mrb_value self)
+// copies a received frame into a existing String, its buffer only gets reallocated when it is too small.
+static void
+mrb_zmq_str_set_bytes(mrb_state *mrb, mrb_value buffer, const void *data, size_t size)
 {
-  zmq_msg_t *msg;
-  mrb_get_args(mrb, "d", &msg, &mrb_zmq_msg_type);
-
-  return mrb_str_new_cstr(mrb, zmq_msg_group(msg));
+  if (RSTRING_CAPA(buffer) < (mrb_int) size) {
+    mrb_str_resize(mrb, buffer, (mrb_int) size);
+  } else {
+    RSTR_SET_LEN(mrb_str_ptr(buffer), size);
+    RSTRING_PTR(buffer)[size] = '\0';
+  }
+  memcpy(RSTRING_PTR(buffer), data, size);
 }
 
+// receives one frame into buffer and returns its size, rcvmore? tells if more frames follow.
 static mrb_value
-mrb_zmq_msg_set_group(mrb_state *mrb, mrb_value self)
+mrb_zmq_socket_recv_into(mrb_state *mrb, mrb_value self)
 {
-  zmq_msg_t *msg;
-  char *group;
-  mrb_get_args(mrb, "dz", &msg, &mrb_zmq_msg_type, &group);
+  mrb_value buffer;
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "S|i", &buffer, &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+  void *socket = mrb_data_get_ptr(mrb, self, &mrb_zmq_socket_type);
+  mrb_str_modify(mrb, mrb_str_ptr(buffer));
 
-  int rc = zmq_msg_set_group(msg, group);
+  zmq_msg_t msg;
+  zmq_msg_init(&msg);
+  MRB_ZMQ_STATS_CLOCK(started);
+  int rc = zmq_msg_recv(&msg, socket, (int) flags);
+  MRB_ZMQ_STATS_RECEIVED_BYTES(mrb, self, rc, !zmq_msg_more(&msg), rc, started);
   if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_msg_set_group");
+    mrb_zmq_handle_error(mrb, "zmq_msg_recv");
   }
+  mrb_zmq_str_set_bytes(mrb, buffer, zmq_msg_data(&msg), zmq_msg_size(&msg));
+  zmq_msg_close(&msg);
 
-  return self;
+  return mrb_convert_number(mrb, rc);
 }
-#endif // ZMQ_DISH
 
+// receives all frames of a message into the Strings of buffers and returns how many frames were received,
+// buffers only grows when a message has more frames than there are Strings in it.
 static mrb_value
-mrb_zmq_socket(mrb_state *mrb, mrb_value self)
+mrb_zmq_socket_recv_multipart_into(mrb_state *mrb, mrb_value self)
 {
-  if (unlikely(DATA_PTR(self))) {
-    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Socket instance already initialized");
+  mrb_value buffers;
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "A|i", &buffers, &flags);
+  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+  void *socket = mrb_data_get_ptr(mrb, self, &mrb_zmq_socket_type);
+  mrb_ary_modify(mrb, mrb_ary_ptr(buffers));
+
+  int ai = mrb_gc_arena_save(mrb);
+  mrb_int i = 0;
+  size_t bytes = 0;
+  int more;
+  MRB_ZMQ_STATS_CLOCK(started);
+  do {
+    zmq_msg_t msg;
+    zmq_msg_init(&msg);
+    int rc = zmq_msg_recv(&msg, socket, (int) flags);
+    if (unlikely(-1 == rc)) {
+      MRB_ZMQ_STATS_RECEIVED_BYTES(mrb, self, -1, 0, 0, started);
+      mrb_zmq_handle_error(mrb, "zmq_msg_recv");
+    }
+    bytes += (size_t) rc;
+    more = zmq_msg_more(&msg);
+
+    mrb_value buffer = mrb_nil_value();
+    if (i < RARRAY_LEN(buffers)) {
+      buffer = mrb_ary_ref(mrb, buffers, i);
+    }
+    if (mrb_string_p(buffer) && !mrb_frozen_p(mrb_basic_ptr(buffer))) {
+      mrb_str_modify(mrb, mrb_str_ptr(buffer));
+      mrb_zmq_str_set_bytes(mrb, buffer, zmq_msg_data(&msg), zmq_msg_size(&msg));
+    } else {
+      buffer = mrb_str_new(mrb, (const char *) zmq_msg_data(&msg), zmq_msg_size(&msg));
+      mrb_ary_set(mrb, buffers, i, buffer);
+    }
+    zmq_msg_close(&msg);
+    mrb_gc_arena_restore(mrb, ai);
+    i++;
+  } while (more);
+  MRB_ZMQ_STATS_RECEIVED_BYTES(mrb, self, 0, 1, bytes, started);
+
+  return mrb_convert_number(mrb, i);
+}
+
+static const char mrb_zmq_z85_encoder[86] =
+  "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#";
+
+// maps characters to their z85 digit, 0xFF marks characters which aren't part of the alphabet
+static const uint8_t mrb_zmq_z85_decoder[256] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x44, 0xFF, 0x54, 0x53, 0x52, 0x48, 0xFF, 0x4B, 0x4C, 0x46, 0x41, 0xFF, 0x3F, 0x3E, 0x45,
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x40, 0xFF, 0x49, 0x42, 0x4A, 0x47,
+  0x51, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32,
+  0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x4D, 0xFF, 0x4E, 0x43, 0xFF,
+  0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+  0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x4F, 0xFF, 0x50, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+// encodes len bytes into len / 4 * 5 characters, a tail of 1 to 3 bytes becomes 2 to 4 characters
+MRB_INLINE void
+mrb_zmq_z85_encode_buf(char *dest, const uint8_t *data, size_t len)
+{
+  size_t groups = len / 4;
+  for (size_t i = 0; i < groups; i++, data += 4, dest += 5) {
+    uint32_t value = ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+    dest[4] = mrb_zmq_z85_encoder[value % 85]; value /= 85;
+    dest[3] = mrb_zmq_z85_encoder[value % 85]; value /= 85;
+    dest[2] = mrb_zmq_z85_encoder[value % 85]; value /= 85;
+    dest[1] = mrb_zmq_z85_encoder[value % 85]; value /= 85;
+    dest[0] = mrb_zmq_z85_encoder[value];
   }
+  size_t tail = len % 4;
+  if (tail) {
+    // zero padded to a whole group, only the leading tail + 1 characters are kept
+    uint8_t group[4] = {0, 0, 0, 0};
+    memcpy(group, data, tail);
+    char encoded[5];
+    mrb_zmq_z85_encode_buf(encoded, group, 4);
+    memcpy(dest, encoded, tail + 1);
+  }
+}
 
-  mrb_int type;
-  mrb_get_args(mrb, "i", &type);
-  mrb_assert_int_fit(mrb_int, type, int, INT_MAX);
+// decodes len characters, a tail of 2 to 4 characters becomes 1 to 3 bytes.
+// returns false on characters outside the alphabet, groups which overflow 32 bits or a tail of 1 character.
+MRB_INLINE bool
+mrb_zmq_z85_decode_buf(uint8_t *dest, const char *string, size_t len)
+{
+  const uint8_t *src = (const uint8_t *) string;
+  size_t groups = len / 5;
+  for (size_t i = 0; i < groups; i++, src += 5, dest += 4) {
+    uint8_t d0 = mrb_zmq_z85_decoder[src[0]], d1 = mrb_zmq_z85_decoder[src[1]], d2 = mrb_zmq_z85_decoder[src[2]],
+      d3 = mrb_zmq_z85_decoder[src[3]], d4 = mrb_zmq_z85_decoder[src[4]];
+    if (unlikely((d0 | d1 | d2 | d3 | d4) & 0x80)) {
+      return false;
+    }
+    uint64_t value = (((((uint64_t) d0 * 85 + d1) * 85 + d2) * 85 + d3) * 85) + d4;
+    if (unlikely(value > UINT32_MAX)) {
+      return false;
+    }
+    dest[0] = (uint8_t) (value >> 24);
+    dest[1] = (uint8_t) (value >> 16);
+    dest[2] = (uint8_t) (value >> 8);
+    dest[3] = (uint8_t) value;
+  }
+  size_t tail = len % 5;
+  if (tail) {
+    if (unlikely(tail == 1)) {
+      return false;
+    }
+    // padded with the highest digit so the truncated value rounds up to the original bytes
+    char group[5] = {'#', '#', '#', '#', '#'};
+    memcpy(group, src, tail);
+    uint8_t decoded[4];
+    if (unlikely(!mrb_zmq_z85_decode_buf(decoded, group, 5))) {
+      return false;
+    }
+    memcpy(dest, decoded, tail - 1);
+  }
 
-  void *socket = zmq_socket(MRB_LIBZMQ_CONTEXT(mrb), (int) type);
-  if (likely(socket)) {
-    mrb_data_init(self, socket, &mrb_zmq_socket_type);
-  } else {
-    mrb_zmq_handle_error(mrb, "zmq_socket");
+  return true;
+}
+
+// output sizes of ZMQ::Z85, without padding the input has to consist of whole groups
+static size_t
+mrb_zmq_z85_encoded_size(mrb_state *mrb, mrb_int size, mrb_bool pad)
+{
+  if (unlikely(!pad && size % 4)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "data size must be divisible by 4");
+  }
+  if (unlikely(size / 4 > (MRB_INT_MAX - 4) / 5)) {
+    mrb_raise(mrb, E_RANGE_ERROR, "Z85 output too large");
   }
+  return size / 4 * 5 + (size % 4 ? size % 4 + 1 : 0);
+}
 
-  return self;
+static size_t
+mrb_zmq_z85_decoded_size(mrb_state *mrb, mrb_int len, mrb_bool pad)
+{
+  if (unlikely(!pad && len % 5)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "string len must be divisible by 5");
+  }
+  if (unlikely(len % 5 == 1)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid Z85 padding");
+  }
+  return len / 5 * 4 + (len % 5 ? len % 5 - 1 : 0);
 }
 
-static mrb_value
-mrb_zmq_socket_monitor(mrb_state *mrb, mrb_value self)
+// appends the encoding of data to buffer and returns the offset it starts at
+static mrb_int
+mrb_zmq_z85_encode_append(mrb_state *mrb, mrb_value buffer, const char *data, mrb_int size, mrb_bool pad)
 {
-  void *socket;
-  char *addr;
-  mrb_int events;
-  mrb_get_args(mrb, "dzi", &socket, &mrb_zmq_socket_type, &addr, &events);
-  mrb_assert_int_fit(mrb_int, events, int, INT_MAX);
+  size_t out_size = mrb_zmq_z85_encoded_size(mrb, size, pad);
+  mrb_int offset = RSTRING_LEN(buffer);
+  if (unlikely((size_t) (MRB_INT_MAX - offset) < out_size)) {
+    mrb_raise(mrb, E_RANGE_ERROR, "Z85 output too large");
+  }
+  mrb_str_modify(mrb, mrb_str_ptr(buffer));
+  mrb_str_resize(mrb, buffer, offset + (mrb_int) out_size);
+  mrb_zmq_z85_encode_buf(RSTRING_PTR(buffer) + offset, (const uint8_t *) data, size);
+  return offset;
+}
 
-  int rc = zmq_socket_monitor(socket, addr, (int) events);
-  if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_socket_monitor");
+static void
+mrb_zmq_z85_decode_append(mrb_state *mrb, mrb_value buffer, const char *string, mrb_int len, mrb_bool pad)
+{
+  size_t out_size = mrb_zmq_z85_decoded_size(mrb, len, pad);
+  mrb_int offset = RSTRING_LEN(buffer);
+  if (unlikely((size_t) (MRB_INT_MAX - offset) < out_size)) {
+    mrb_raise(mrb, E_RANGE_ERROR, "Z85 output too large");
   }
+  mrb_str_modify(mrb, mrb_str_ptr(buffer));
+  mrb_str_resize(mrb, buffer, offset + (mrb_int) out_size);
+  if (unlikely(!mrb_zmq_z85_decode_buf((uint8_t *) RSTRING_PTR(buffer) + offset, string, len))) {
+    mrb_str_resize(mrb, buffer, offset);
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid Z85 string");
+  }
+}
 
-  return self;
+// ZMQ::Z85.encode(data, pad = false), with pad any size is accepted and the last group is shortened
+static mrb_value
+mrb_zmq_z85_encode_m(mrb_state *mrb, mrb_value self)
+{
+  const char *data;
+  mrb_int size;
+  mrb_bool pad = FALSE;
+  mrb_get_args(mrb, "s|b", &data, &size, &pad);
+
+  mrb_value dest = mrb_str_new_capa(mrb, mrb_zmq_z85_encoded_size(mrb, size, pad));
+  mrb_zmq_z85_encode_append(mrb, dest, data, size, pad);
+
+  return dest;
 }
 
 static mrb_value
-mrb_zmq_socket_recv(mrb_state *mrb, mrb_value self)
+mrb_zmq_z85_decode_m(mrb_state *mrb, mrb_value self)
 {
-  mrb_int flags = 0;
-  mrb_get_args(mrb, "|i", &flags);
-  mrb_assert_int_fit(mrb_int, flags, int, INT_MAX);
+  const char *string;
+  mrb_int len;
+  mrb_bool pad = FALSE;
+  mrb_get_args(mrb, "s|b", &string, &len, &pad);
 
-  int more;
-  mrb_value data = mrb_nil_value();
-  struct RClass *zmq_msg_class = mrb_class_get_under_id(mrb, mrb_module_get_id(mrb, MRB_SYM(ZMQ)), MRB_SYM(Msg));
-  void *socket = mrb_data_get_ptr(mrb, self, &mrb_zmq_socket_type);
+  mrb_value dest = mrb_str_new_capa(mrb, mrb_zmq_z85_decoded_size(mrb, len, pad));
+  mrb_zmq_z85_decode_append(mrb, dest, string, len, pad);
 
-  do {
-    mrb_value msg_val = mrb_obj_new(mrb, zmq_msg_class, 0, NULL);
-    zmq_msg_t *msg = (zmq_msg_t *) mrb_data_get_ptr(mrb, msg_val, &mrb_zmq_msg_type);
+  return dest;
+}
 
-    int rc = zmq_msg_recv (msg, socket, (int) flags);
-    if (unlikely(-1 == rc)) {
-      mrb_zmq_handle_error(mrb, "zmq_msg_recv");
-    }
-    more = zmq_msg_more(msg);
-    if (more) {
-      if (!mrb_array_p(data)) {
-        data = mrb_ary_new_capa(mrb, 2); // We have at least two zmq messages at this point.
-      }
-      mrb_ary_push(mrb, data, msg_val);
-    } else {
-      if (mrb_array_p(data)) {
-        mrb_ary_push(mrb, data, msg_val);
-      } else {
-        data = msg_val;
-      }
-    }
-  } while (more);
+// ZMQ::Z85.encode_into(buffer, data, pad = false) appends to buffer, so chunks can be streamed into one String.
+// Clearing the buffer before reusing it keeps its capacity.
+static mrb_value
+mrb_zmq_z85_encode_into(mrb_state *mrb, mrb_value self)
+{
+  mrb_value buffer, data;
+  mrb_bool pad = FALSE;
+  mrb_get_args(mrb, "SS|b", &buffer, &data, &pad);
+  if (unlikely(mrb_obj_eq(mrb, buffer, data))) {
+    // growing buffer would move data
+    data = mrb_str_dup(mrb, data);
+  }
+  mrb_zmq_z85_encode_append(mrb, buffer, RSTRING_PTR(data), RSTRING_LEN(data), pad);
 
-  return data;
+  return buffer;
+}
+
+static mrb_value
+mrb_zmq_z85_decode_into(mrb_state *mrb, mrb_value self)
+{
+  mrb_value buffer, string;
+  mrb_bool pad = FALSE;
+  mrb_get_args(mrb, "SS|b", &buffer, &string, &pad);
+  if (unlikely(mrb_obj_eq(mrb, buffer, string))) {
+    string = mrb_str_dup(mrb, string);
+  }
+  mrb_zmq_z85_decode_append(mrb, buffer, RSTRING_PTR(string), RSTRING_LEN(string), pad);
+
+  return buffer;
 }
 
 static mrb_value
 mrb_zmq_z85_decode(mrb_state *mrb, mrb_value self)
 {
-  char *string;
-  mrb_get_args(mrb, "z", &string);
-  size_t string_len = strlen(string);
+  mrb_value string_val;
+  mrb_get_args(mrb, "S", &string_val);
+  size_t string_len = RSTRING_LEN(string_val);
+  const char *string = mrb_string_value_cstr(mrb, &string_val);
 
   if (unlikely(string_len % 5)) {
     mrb_raise(mrb, E_ARGUMENT_ERROR, "string len must be divisible by 5");
@@ -683,25 +3426,29 @@ mrb_zmq_poller_new(mrb_state *mrb, mrb_value self)
     mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Poller instance already initialized");
   }
 
-  void *poller = zmq_poller_new();
-  if (unlikely(!poller)) {
+  mrb_value sockets = mrb_hash_new(mrb);
+  mrb_iv_set(mrb, self, MRB_SYM(sockets), sockets);
+  mrb_iv_set(mrb, self, MRB_SYM(ready), mrb_ary_new(mrb));
+  mrb_iv_set(mrb, self, MRB_SYM(ready_events), mrb_ary_new(mrb));
+
+  void *zmq_poller = zmq_poller_new();
+  if (unlikely(!zmq_poller)) {
     mrb_zmq_handle_error(mrb, "zmq_poller_new");
   }
+  mrb_zmq_poller_t *poller = new mrb_zmq_poller_t();
+  poller->poller = zmq_poller;
   mrb_data_init(self, poller, &mrb_zmq_poller_type);
-  mrb_iv_set(mrb, self, MRB_SYM(sockets), mrb_ary_new(mrb));
 
   return self;
 }
 
-static mrb_value
-mrb_zmq_poller_add(mrb_state *mrb, mrb_value self)
+static void
+mrb_zmq_poller_add_object(mrb_state *mrb, mrb_value self, mrb_value socket, mrb_int events)
 {
-  mrb_value socket;
-  mrb_int events = ZMQ_POLLIN;
-  mrb_get_args(mrb, "o|i", &socket, &events);
   struct RClass *socket_class = mrb_obj_class(mrb, socket);
   mrb_assert_int_fit(mrb_int, events, short, SHRT_MAX);
-  void *poller = mrb_data_get_ptr(mrb, self, &mrb_zmq_poller_type);
+  mrb_zmq_poller_t *poller = (mrb_zmq_poller_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_poller_type);
+  mrb_value sockets = mrb_iv_get(mrb, self, MRB_SYM(sockets));
 
   int rc;
   if (mrb_obj_respond_to(mrb, socket_class, MRB_SYM(fileno))) {
@@ -709,21 +3456,35 @@ mrb_zmq_poller_add(mrb_state *mrb, mrb_value self)
       mrb_int fd = mrb_integer(fd_val);
       mrb_assert_int_fit(mrb_int, fd, int, INT_MAX);
 
-      rc = zmq_poller_add_fd(poller, (int) fd, mrb_ptr(socket), events);
+      rc = zmq_poller_add_fd(poller->poller, (int) fd, mrb_ptr(socket), events);
       if (unlikely(-1 == rc)) {
         mrb_zmq_handle_error(mrb, "zmq_poller_add_fd");
       }
   } else if (mrb_obj_respond_to(mrb, socket_class, MRB_SYM(zmq_socket))) {
-    rc = zmq_poller_add(poller, mrb_zmq_get_socket(mrb, mrb_funcall_id(mrb, socket, MRB_SYM(zmq_socket), 0)), mrb_ptr(socket), events);
+    rc = zmq_poller_add(poller->poller, mrb_zmq_get_socket(mrb, mrb_funcall_id(mrb, socket, MRB_SYM(zmq_socket), 0)), mrb_ptr(socket), events);
   } else {
-    rc = zmq_poller_add(poller, mrb_zmq_get_socket(mrb, socket), mrb_ptr(socket), events);
+    rc = zmq_poller_add(poller->poller, mrb_zmq_get_socket(mrb, socket), mrb_ptr(socket), events);
   }
 
   if (unlikely(-1 == rc)) {
     mrb_zmq_handle_error(mrb, "zmq_poller_add");
   }
 
-  mrb_ary_push(mrb, mrb_iv_get(mrb, self, MRB_SYM(sockets)), socket);
+  mrb_hash_set(mrb, sockets, mrb_zmq_ptr_key(mrb, mrb_ptr(socket)), socket);
+  size_t n_sockets = static_cast<size_t>(mrb_hash_size(mrb, sockets));
+  if (poller->events.size() < n_sockets) {
+    poller->events.resize(n_sockets);
+  }
+}
+
+static mrb_value
+mrb_zmq_poller_add(mrb_state *mrb, mrb_value self)
+{
+  mrb_value socket;
+  mrb_int events = ZMQ_POLLIN;
+  mrb_get_args(mrb, "o|i", &socket, &events);
+
+  mrb_zmq_poller_add_object(mrb, self, socket, events);
 
   return self;
 }
@@ -736,7 +3497,7 @@ mrb_zmq_poller_modify(mrb_state *mrb, mrb_value self)
   mrb_get_args(mrb, "oi", &socket, &events);
   struct RClass *socket_class = mrb_obj_class(mrb, socket);
   mrb_assert_int_fit(mrb_int, events, short, SHRT_MAX);
-  void *poller = mrb_data_get_ptr(mrb, self, &mrb_zmq_poller_type);
+  void *poller = ((mrb_zmq_poller_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_poller_type))->poller;
 
   int rc;
   if (mrb_obj_respond_to(mrb, socket_class, MRB_SYM(fileno))) {
@@ -760,13 +3521,11 @@ mrb_zmq_poller_modify(mrb_state *mrb, mrb_value self)
   return self;
 }
 
-static mrb_value
-mrb_zmq_poller_remove(mrb_state *mrb, mrb_value self)
+static void
+mrb_zmq_poller_remove_object(mrb_state *mrb, mrb_value self, mrb_value socket)
 {
-  mrb_value socket;
-  mrb_get_args(mrb, "o", &socket);
   struct RClass *socket_class = mrb_obj_class(mrb, socket);
-  void *poller = mrb_data_get_ptr(mrb, self, &mrb_zmq_poller_type);
+  void *poller = ((mrb_zmq_poller_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_poller_type))->poller;
 
   int rc;
   if (mrb_obj_respond_to(mrb, socket_class, MRB_SYM(fileno))) {
@@ -780,16 +3539,57 @@ mrb_zmq_poller_remove(mrb_state *mrb, mrb_value self)
   } else if (mrb_obj_respond_to(mrb, socket_class, MRB_SYM(zmq_socket))) {
     rc = zmq_poller_remove(poller, mrb_zmq_get_socket(mrb, mrb_funcall_id(mrb, socket, MRB_SYM(zmq_socket), 0)));
   } else {
-    rc = zmq_poller_remove(poller, mrb_zmq_get_socket(mrb, socket));
+    rc = zmq_poller_remove(poller, mrb_zmq_get_socket(mrb, socket));
+  }
+
+  if (unlikely(-1 == rc)) {
+    mrb_zmq_handle_error(mrb, "zmq_poller_remove");
+  }
+
+  mrb_hash_delete_key(mrb, mrb_iv_get(mrb, self, MRB_SYM(sockets)), mrb_zmq_ptr_key(mrb, mrb_ptr(socket)));
+}
+
+static mrb_value
+mrb_zmq_poller_remove(mrb_state *mrb, mrb_value self)
+{
+  mrb_value socket;
+  mrb_get_args(mrb, "o", &socket);
+
+  mrb_zmq_poller_remove_object(mrb, self, socket);
+
+  return self;
+}
+
+// returns the number of ready events in poller->events, 0 on timeout and -1 when interrupted.
+static int
+mrb_zmq_poller_wait_events(mrb_state *mrb, mrb_zmq_poller_t *poller, mrb_int timeout)
+{
+  int rc;
+  MRB_ZMQ_STATS_CLOCK(started);
+  if (likely(!poller->events.empty())) {
+    rc = zmq_poller_wait_all(poller->poller, poller->events.data(), (int) poller->events.size(), (long) timeout);
+  } else {
+    zmq_poller_event_t event;
+    rc = zmq_poller_wait_all(poller->poller, &event, 0, (long) timeout);
   }
+  MRB_ZMQ_STATS_POLLED(mrb, started);
 
-  if (unlikely(-1 == rc)) {
-    mrb_zmq_handle_error(mrb, "zmq_poller_remove");
+  if (-1 == rc) {
+    switch(mrb_zmq_errno()) {
+      case ETIMEDOUT:
+      case EAGAIN: {
+        return 0;
+      }
+      case EINTR: {
+        return -1;
+      }
+      default: {
+        mrb_zmq_handle_error(mrb, "zmq_poller_wait_all");
+      }
+    }
   }
 
-  mrb_funcall(mrb, mrb_iv_get(mrb, self, MRB_SYM(sockets)), "delete", 1, socket);
-
-  return self;
+  return rc;
 }
 
 static mrb_value
@@ -798,12 +3598,13 @@ mrb_zmq_poller_wait(mrb_state *mrb, mrb_value self)
   mrb_int timeout = -1;
   mrb_value block = mrb_nil_value();
   mrb_get_args(mrb, "|i&", &timeout, &block);
-  void *poller = mrb_data_get_ptr(mrb, self, &mrb_zmq_poller_type);
+  mrb_zmq_poller_t *poller = (mrb_zmq_poller_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_poller_type);
 
-  int rc;
   if (mrb_type(block) != MRB_TT_PROC) {
     zmq_poller_event_t event;
-    rc = zmq_poller_wait(poller, &event, (long) timeout);
+    MRB_ZMQ_STATS_CLOCK(started);
+    int rc = zmq_poller_wait(poller->poller, &event, (long) timeout);
+    MRB_ZMQ_STATS_POLLED(mrb, started);
     if (-1 == rc) {
       switch(mrb_zmq_errno()) {
         case ETIMEDOUT: {
@@ -823,48 +3624,68 @@ mrb_zmq_poller_wait(mrb_state *mrb, mrb_value self)
 
     return mrb_obj_value(event.user_data);
   } else {
-    mrb_int n_events = RARRAY_LEN(mrb_iv_get(mrb, self, MRB_SYM(sockets)));
-    if (n_events > 0) {
-      std::vector<zmq_poller_event_t> events(static_cast<size_t>(n_events));
-
-      rc = zmq_poller_wait_all(poller,
-                              events.data(),
-                              n_events,
-                              timeout);
-
-      for (int i = 0; i < rc; i++) {
-        mrb_value argv[] = {
-          mrb_obj_value(events[i].user_data),
-          mrb_convert_number(mrb, events[i].events)
-        };
-        mrb_yield_argv(mrb, block, NELEMS(argv), argv);
-      }
-    } else {
-      zmq_poller_event_t event;
-      rc = zmq_poller_wait_all(poller, &event, 0, timeout);
+    int rc = mrb_zmq_poller_wait_events(mrb, poller, timeout);
+    if (rc == 0) {
+      return mrb_nil_value();
+    } else if (rc == -1) {
+      return mrb_false_value();
     }
 
-
-    if (-1 == rc) {
-      switch(mrb_zmq_errno()) {
-        case ETIMEDOUT: {
-          return mrb_nil_value();
-        }
-        case EAGAIN: {
-          return mrb_nil_value();
-        }
-        case EINTR: {
-          return mrb_false_value();
-        }
-        default: {
-          mrb_zmq_handle_error(mrb, "zmq_poller_wait_all");
-        }
+    mrb_value sockets = mrb_iv_get(mrb, self, MRB_SYM(sockets));
+    for (int i = 0; i < rc; i++) {
+      zmq_poller_event_t event = poller->events[i];
+      // the block could have removed a object which is still pending in our events, its memory might be gone already.
+      mrb_value socket = mrb_hash_get(mrb, sockets, mrb_zmq_ptr_key(mrb, event.user_data));
+      if (unlikely(mrb_nil_p(socket))) {
+        continue;
       }
+      mrb_value argv[] = {
+        socket,
+        mrb_convert_number(mrb, event.events)
+      };
+      mrb_yield_argv(mrb, block, NELEMS(argv), argv);
     }
 
     return self;
   }
 }
+
+// fills and returns the same Array of ready objects on every call, their events are in ready_events.
+static mrb_value
+mrb_zmq_poller_wait_all(mrb_state *mrb, mrb_value self)
+{
+  mrb_int timeout = -1;
+  mrb_get_args(mrb, "|i", &timeout);
+  mrb_zmq_poller_t *poller = (mrb_zmq_poller_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_poller_type);
+
+  int rc = mrb_zmq_poller_wait_events(mrb, poller, timeout);
+  if (rc == -1) {
+    return mrb_false_value();
+  }
+
+  mrb_value ready = mrb_iv_get(mrb, self, MRB_SYM(ready));
+  mrb_value ready_events = mrb_iv_get(mrb, self, MRB_SYM(ready_events));
+  for (int i = 0; i < rc; i++) {
+    mrb_ary_set(mrb, ready, i, mrb_obj_value(poller->events[i].user_data));
+    mrb_ary_set(mrb, ready_events, i, mrb_convert_number(mrb, poller->events[i].events));
+  }
+  mrb_ary_resize(mrb, ready, rc);
+  mrb_ary_resize(mrb, ready_events, rc);
+
+  return rc == 0 ? mrb_nil_value() : ready;
+}
+
+static mrb_value
+mrb_zmq_poller_ready_events(mrb_state *mrb, mrb_value self)
+{
+  return mrb_iv_get(mrb, self, MRB_SYM(ready_events));
+}
+
+static mrb_value
+mrb_zmq_poller_size(mrb_state *mrb, mrb_value self)
+{
+  return mrb_convert_number(mrb, mrb_hash_size(mrb, mrb_iv_get(mrb, self, MRB_SYM(sockets))));
+}
 #endif // ZMQ_HAVE_POLLER
 
 #ifdef ZMQ_HAVE_TIMERS
@@ -994,6 +3815,380 @@ mrb_zmq_timers_execute(mrb_state *mrb, mrb_value self)
 }
 #endif //ZMQ_HAVE_TIMERS
 
+#if defined(ZMQ_HAVE_POLLER) && defined(ZMQ_HAVE_TIMERS)
+// ZMQ::Reactor is a ZMQ::Poller with a handler per polled object and its own ZMQ::Timers,
+// run_once waits for whichever comes first and dispatches both without a ruby level loop.
+static mrb_value
+mrb_zmq_reactor_new(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_poller_new(mrb, self);
+  mrb_iv_set(mrb, self, MRB_SYM(handlers), mrb_hash_new(mrb));
+  mrb_iv_set(mrb, self, MRB_SYM(timers), mrb_obj_new(mrb, mrb_zmq_get_state(mrb)->zmq_timers_class, 0, NULL));
+  mrb_iv_set(mrb, self, MRB_SYM(running), mrb_false_value());
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_reactor_add(mrb_state *mrb, mrb_value self)
+{
+  mrb_value socket;
+  mrb_int events = ZMQ_POLLIN;
+  mrb_value block = mrb_nil_value();
+  mrb_get_args(mrb, "o|i&", &socket, &events, &block);
+  if (unlikely(mrb_type(block) != MRB_TT_PROC)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+  }
+
+  mrb_zmq_poller_add_object(mrb, self, socket, events);
+  mrb_hash_set(mrb, mrb_iv_get(mrb, self, MRB_SYM(handlers)), mrb_zmq_ptr_key(mrb, mrb_ptr(socket)), block);
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_reactor_remove(mrb_state *mrb, mrb_value self)
+{
+  mrb_value socket;
+  mrb_get_args(mrb, "o", &socket);
+
+  mrb_zmq_poller_remove_object(mrb, self, socket);
+  mrb_hash_delete_key(mrb, mrb_iv_get(mrb, self, MRB_SYM(handlers)), mrb_zmq_ptr_key(mrb, mrb_ptr(socket)));
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_reactor_timers(mrb_state *mrb, mrb_value self)
+{
+  return mrb_iv_get(mrb, self, MRB_SYM(timers));
+}
+
+// waits until a polled object is ready or the next timer is due, whichever comes first.
+// returns the number of ready objects, 0 on timeout and -1 when interrupted.
+static int
+mrb_zmq_reactor_dispatch(mrb_state *mrb, mrb_value self, mrb_int timeout)
+{
+  mrb_zmq_poller_t *poller = (mrb_zmq_poller_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_poller_type);
+  void *timers = mrb_data_get_ptr(mrb, mrb_iv_get(mrb, self, MRB_SYM(timers)), &mrb_zmq_timers_type);
+
+  long timers_timeout = zmq_timers_timeout(timers);
+  if (timers_timeout != -1 && (timeout < 0 || timers_timeout < timeout)) {
+    timeout = timers_timeout;
+  }
+
+  int rc = mrb_zmq_poller_wait_events(mrb, poller, timeout);
+  if (rc > 0) {
+    mrb_value handlers = mrb_iv_get(mrb, self, MRB_SYM(handlers));
+    int ai = mrb_gc_arena_save(mrb);
+    for (int i = 0; i < rc; i++) {
+      zmq_poller_event_t event = poller->events[i];
+      // a handler is removed together with its object, so a missing one means a earlier handler removed it.
+      mrb_value handler = mrb_hash_get(mrb, handlers, mrb_zmq_ptr_key(mrb, event.user_data));
+      if (unlikely(mrb_nil_p(handler))) {
+        continue;
+      }
+      mrb_value argv[] = {
+        mrb_obj_value(event.user_data),
+        mrb_convert_number(mrb, event.events)
+      };
+      mrb_yield_argv(mrb, handler, NELEMS(argv), argv);
+      mrb_gc_arena_restore(mrb, ai);
+    }
+  }
+
+  if (unlikely(-1 == zmq_timers_execute(timers))) {
+    mrb_zmq_handle_error(mrb, "zmq_timers_execute");
+  }
+
+  return rc;
+}
+
+static mrb_value
+mrb_zmq_reactor_run_once(mrb_state *mrb, mrb_value self)
+{
+  mrb_int timeout = -1;
+  mrb_get_args(mrb, "|i", &timeout);
+
+  int rc = mrb_zmq_reactor_dispatch(mrb, self, timeout);
+  if (rc == -1) {
+    return mrb_false_value();
+  }
+
+  return mrb_convert_number(mrb, rc);
+}
+
+// runs until stop is called or there is nothing left to wait for.
+static mrb_value
+mrb_zmq_reactor_loop(mrb_state *mrb, mrb_value self)
+{
+  mrb_value sockets = mrb_iv_get(mrb, self, MRB_SYM(sockets));
+  void *timers = mrb_data_get_ptr(mrb, mrb_iv_get(mrb, self, MRB_SYM(timers)), &mrb_zmq_timers_type);
+
+  int ai = mrb_gc_arena_save(mrb);
+  while (mrb_test(mrb_iv_get(mrb, self, MRB_SYM(running)))) {
+    if (mrb_hash_size(mrb, sockets) == 0 && zmq_timers_timeout(timers) == -1) {
+      break;
+    }
+    mrb_zmq_reactor_dispatch(mrb, self, -1);
+    mrb_gc_arena_restore(mrb, ai);
+  }
+
+  return self;
+}
+
+static mrb_value
+mrb_zmq_reactor_stop(mrb_state *mrb, mrb_value self)
+{
+  mrb_iv_set(mrb, self, MRB_SYM(running), mrb_false_value());
+
+  return self;
+}
+
+// a handler which raises leaves the reactor stopped, so run can be called again.
+static mrb_value
+mrb_zmq_reactor_run(mrb_state *mrb, mrb_value self)
+{
+  mrb_iv_set(mrb, self, MRB_SYM(running), mrb_true_value());
+
+  return mrb_ensure(mrb, mrb_zmq_reactor_loop, self, mrb_zmq_reactor_stop, self);
+}
+#endif
+
+static mrb_value
+mrb_zmq_msg_pool_stats(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_msg_pool_t *pool = mrb_zmq_get_state(mrb)->msg_pool;
+
+  mrb_value stats = mrb_hash_new_capa(mrb, 6);
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(size)),   mrb_convert_number(mrb, pool->size));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(max)),    mrb_convert_number(mrb, pool->max));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(live)),   mrb_convert_number(mrb, pool->live));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(hits)),   mrb_convert_number(mrb, pool->hits));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(misses)), mrb_convert_number(mrb, pool->misses));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(MRB_SYM(drops)),  mrb_convert_number(mrb, pool->drops));
+
+  return stats;
+}
+
+static mrb_value
+mrb_zmq_msg_pool_set_max(mrb_state *mrb, mrb_value self)
+{
+  mrb_int max;
+  mrb_get_args(mrb, "i", &max);
+  if (unlikely(max < 0)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "max must not be negative");
+  }
+
+  mrb_zmq_msg_pool_t *pool = mrb_zmq_get_state(mrb)->msg_pool;
+  pool->max = max;
+  mrb_zmq_msg_pool_trim(mrb, pool, max);
+
+  return mrb_convert_number(mrb, max);
+}
+
+static mrb_value
+mrb_zmq_live_msg_bytes(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_state_t *state = mrb_zmq_get_state(mrb);
+  mrb_zmq_reap_zero_copy(mrb, state);
+  return mrb_convert_number(mrb, state->msg_pool->live_bytes);
+}
+
+static mrb_value
+mrb_zmq_gc_pressure_limit(mrb_state *mrb, mrb_value self)
+{
+  return mrb_convert_number(mrb, mrb_zmq_get_state(mrb)->msg_pool->pressure_limit);
+}
+
+static mrb_value
+mrb_zmq_gc_pressure_set_limit(mrb_state *mrb, mrb_value self)
+{
+  mrb_int limit;
+  mrb_get_args(mrb, "i", &limit);
+  if (unlikely(limit < 0)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "limit must not be negative");
+  }
+
+  mrb_zmq_msg_pool_t *pool = mrb_zmq_get_state(mrb)->msg_pool;
+  pool->pressure_limit = (size_t) limit;
+  pool->baseline = pool->live_bytes;
+
+  return mrb_convert_number(mrb, limit);
+}
+
+// joins the native thread and takes it out of the registry, which lets its pipe be collected.
+static void
+mrb_zmq_thread_close(mrb_state *mrb, mrb_zmq_state_t *state, mrb_zmq_thread_t *thread)
+{
+  if (thread->handle) {
+    zmq_threadclose(thread->handle);
+    thread->handle = NULL;
+  }
+  if (thread->pipe) {
+    thread->pipe = NULL;
+    mrb_hash_delete_key(mrb, state->threads, mrb_zmq_ptr_key(mrb, thread));
+    mrb_zmq_thread_unref(thread);
+  }
+}
+
+// joins threads which finished without being joined, their ZMQ::Thread may have been collected already.
+static void
+mrb_zmq_reap_threads(mrb_state *mrb, mrb_zmq_state_t *state)
+{
+  mrb_value keys = mrb_hash_keys(mrb, state->threads);
+  for (mrb_int i = 0; i < RARRAY_LEN(keys); i++) {
+    mrb_zmq_thread_t *thread = (mrb_zmq_thread_t *) (intptr_t) mrb_integer(RARRAY_PTR(keys)[i]);
+    if (thread->finished.load(std::memory_order_acquire)) {
+      mrb_zmq_thread_close(mrb, state, thread);
+    }
+  }
+}
+
+static mrb_value
+mrb_zmq_thread_set_context(mrb_state *mrb, mrb_value context)
+{
+  mrb_zmq_set_context(mrb, mrb_cptr(context));
+  return mrb_nil_value();
+}
+
+// runs on the native thread, everything it allocates belongs to its own mrb_state.
+// Nothing may raise outside of mrb_protect here, there is no jmpbuf to catch it.
+static void
+mrb_zmq_thread_fn(void *thread_)
+{
+  mrb_zmq_thread_t *thread = (mrb_zmq_thread_t *) thread_;
+
+  mrb_state *mrb = mrb_open();
+  if (unlikely(!mrb)) {
+    thread->error_class = "NoMemoryError";
+    thread->error_message = "mrb_open failed";
+    thread->failed = true;
+  } else {
+    mrb_bool failed = FALSE;
+    mrb_value error = mrb_protect(mrb, mrb_zmq_thread_set_context, mrb_cptr_value(mrb, thread->context), &failed);
+    if (unlikely(failed)) {
+      mrb->exc = mrb_obj_ptr(error);
+    }
+    mrb_value proc = mrb_nil_value();
+    if (likely(!mrb->exc)) {
+      proc = mrb_load_nstring(mrb, thread->code.data(), thread->code.size());
+    }
+    mrb_value result = mrb_nil_value();
+    if (likely(!mrb->exc)) {
+      mrb_value argv[] = {
+        mrb_str_new(mrb, thread->endpoint.data(), thread->endpoint.size()),
+        proc,
+        mrb_str_new(mrb, thread->args.data(), thread->args.size())
+      };
+      result = mrb_funcall_argv(mrb, mrb_obj_value(mrb_zmq_get_state(mrb)->zmq_thread_class), MRB_SYM(__run__), NELEMS(argv), argv);
+    }
+    if (mrb->exc) {
+      mrb_value exc = mrb_obj_value(mrb->exc);
+      mrb->exc = NULL;
+      thread->error_class = mrb_obj_classname(mrb, exc);
+      mrb_value message = mrb_funcall_id(mrb, exc, MRB_SYM(message), 0);
+      if (mrb_string_p(message)) {
+        thread->error_message.assign(RSTRING_PTR(message), RSTRING_LEN(message));
+      }
+      thread->failed = true;
+    } else if (mrb_data_check_get_ptr(mrb, result, &mrb_zmq_msg_type)) {
+      zmq_msg_t *msg = (zmq_msg_t *) DATA_PTR(result);
+      thread->result.assign((const char *) zmq_msg_data(msg), zmq_msg_size(msg));
+    }
+    mrb_close(mrb);
+  }
+
+  thread->finished.store(true, std::memory_order_release);
+  mrb_zmq_thread_unref(thread);
+}
+
+// binds the parent end of the pipe and starts the thread, the child connects the other end.
+static mrb_value
+mrb_zmq_thread_start(mrb_state *mrb, mrb_value self)
+{
+  if (unlikely(DATA_PTR(self))) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Thread instance already initialized");
+  }
+
+  mrb_value pipe_val;
+  char *code;
+  mrb_int code_len;
+  zmq_msg_t *args;
+  mrb_get_args(mrb, "osd", &pipe_val, &code, &code_len, &args, &mrb_zmq_msg_type);
+  void *pipe = mrb_data_get_ptr(mrb, pipe_val, &mrb_zmq_socket_type);
+  mrb_zmq_state_t *state = mrb_zmq_get_state(mrb);
+  mrb_zmq_reap_threads(mrb, state);
+
+  mrb_zmq_thread_t *thread = new mrb_zmq_thread_t();
+  thread->failed = false;
+  thread->finished = false;
+  thread->refcount = 1;
+  mrb_data_init(self, thread, &mrb_zmq_thread_type);
+
+  char endpoint[64];
+  snprintf(endpoint, sizeof(endpoint), "inproc://mrb-zmq-thread-%p", (void *) thread);
+  if (unlikely(-1 == zmq_bind(pipe, endpoint))) {
+    mrb_zmq_handle_error(mrb, "zmq_bind");
+  }
+  thread->endpoint = endpoint;
+  thread->code.assign(code, code_len);
+  thread->args.assign((const char *) zmq_msg_data(args), zmq_msg_size(args));
+  thread->context = MRB_LIBZMQ_CONTEXT(mrb);
+
+  thread->refcount++;
+  thread->handle = zmq_threadstart(mrb_zmq_thread_fn, thread);
+  if (unlikely(!thread->handle)) {
+    thread->refcount--;
+    mrb_zmq_handle_error(mrb, "zmq_threadstart");
+  }
+  thread->pipe = RDATA(pipe_val);
+  thread->refcount++;
+  mrb_hash_set(mrb, state->threads, mrb_zmq_ptr_key(mrb, thread), pipe_val);
+
+  return mrb_str_new_cstr(mrb, endpoint);
+}
+
+// waits for the thread to exit, returns [true, value] or [false, error class name, error message]
+static mrb_value
+mrb_zmq_thread_join(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_thread_t *thread = (mrb_zmq_thread_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_thread_type);
+  if (unlikely(!thread)) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "ZMQ::Thread wasn't started");
+  }
+
+  mrb_zmq_thread_close(mrb, mrb_zmq_get_state(mrb), thread);
+
+  if (thread->failed) {
+    mrb_value argv[] = {
+      mrb_false_value(),
+      mrb_str_new(mrb, thread->error_class.data(), thread->error_class.size()),
+      mrb_str_new(mrb, thread->error_message.data(), thread->error_message.size())
+    };
+    return mrb_ary_new_from_values(mrb, NELEMS(argv), argv);
+  }
+
+  mrb_value result = mrb_nil_value();
+  if (!thread->result.empty()) {
+    mrb_zmq_unpack_t in;
+    in.p = (const uint8_t *) thread->result.data();
+    in.end = in.p + thread->result.size();
+    result = mrb_zmq_unpack_value(mrb, &in, 0);
+  }
+  mrb_value argv[] = { mrb_true_value(), result };
+
+  return mrb_ary_new_from_values(mrb, NELEMS(argv), argv);
+}
+
+static mrb_value
+mrb_zmq_thread_alive(mrb_state *mrb, mrb_value self)
+{
+  mrb_zmq_thread_t *thread = (mrb_zmq_thread_t *) mrb_data_get_ptr(mrb, self, &mrb_zmq_thread_type);
+
+  return mrb_bool_value(thread && !thread->finished.load(std::memory_order_acquire));
+}
+
 #ifdef HAVE_IFADDRS_H
 MRB_INLINE mrb_bool
 s_valid_flags (unsigned int flags)
@@ -1046,10 +4241,29 @@ mrb_network_interfaces(mrb_state *mrb, mrb_value self)
 }
 #endif //HAVE_IFADDRS_H
 
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+// applies a comma separated cpu list like "2,3" from the environment
+static void
+mrb_zmq_ctx_set_cpus(void *context, int option_name, const char *cpus)
+{
+  char *end;
+  for (long cpu = strtol(cpus, &end, 10); end != cpus; cpu = strtol(cpus, &end, 10)) {
+    zmq_ctx_set(context, option_name, (int) cpu);
+    cpus = end;
+    if (*cpus != ',') {
+      break;
+    }
+    cpus++;
+  }
+}
+#endif
+
 MRB_BEGIN_DECL
 void
 mrb_mruby_zmq_gem_init(mrb_state* mrb)
 {
+  mrb_zmq_state_t *state = mrb_zmq_state_init(mrb);
+
   void *context = zmq_ctx_new();
   if (unlikely(!context)) {
     mrb_sys_fail(mrb, "zmq_ctx_new");
@@ -1063,13 +4277,31 @@ mrb_mruby_zmq_gem_init(mrb_state* mrb)
   if (getenv("ZMQ_THREAD_PRIORITY")) {
     zmq_ctx_set(context, ZMQ_THREAD_PRIORITY, atoi(getenv("ZMQ_THREAD_PRIORITY")));
   }
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+  if (getenv("ZMQ_THREAD_AFFINITY_CPU_ADD")) {
+    mrb_zmq_ctx_set_cpus(context, ZMQ_THREAD_AFFINITY_CPU_ADD, getenv("ZMQ_THREAD_AFFINITY_CPU_ADD"));
+  }
+  if (getenv("ZMQ_THREAD_AFFINITY_CPU_REMOVE")) {
+    mrb_zmq_ctx_set_cpus(context, ZMQ_THREAD_AFFINITY_CPU_REMOVE, getenv("ZMQ_THREAD_AFFINITY_CPU_REMOVE"));
+  }
+#endif
+#ifdef ZMQ_THREAD_NAME_PREFIX
+  if (getenv("ZMQ_THREAD_NAME_PREFIX")) {
+    zmq_ctx_set(context, ZMQ_THREAD_NAME_PREFIX, atoi(getenv("ZMQ_THREAD_NAME_PREFIX")));
+  }
+#endif
+  if (getenv("ZMQ_AFFINITY")) {
+    state->socket_affinity = strtoull(getenv("ZMQ_AFFINITY"), NULL, 0);
+  }
 
   struct RClass *libzmq_mod, *zmq_mod, *zmq_msg_class, *zmq_socket_class;
 
   libzmq_mod = mrb_define_module_id(mrb, MRB_SYM(LibZMQ));
+  state->context = context;
+  state->libzmq_mod = libzmq_mod;
   mrb_define_const_id(mrb, libzmq_mod, MRB_SYM(__CTX__),
                       mrb_cptr_value(mrb, context));
-  mrb_define_const_id(mrb, mrb_module_get_id(mrb, MRB_SYM(LibZMQ)), MRB_SYM(__foreigen_context__),
+  mrb_define_const_id(mrb, libzmq_mod, MRB_SYM(__foreigen_context__),
                       mrb_false_value());
 
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(bind),           mrb_zmq_bind,           MRB_ARGS_REQ(2));
@@ -1083,12 +4315,19 @@ mrb_mruby_zmq_gem_init(mrb_state* mrb)
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(getsockopt),     mrb_zmq_getsockopt,     MRB_ARGS_ARG(3, 1));
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(msg_gets),       mrb_zmq_msg_gets,       MRB_ARGS_ARG(2, 1));
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(msg_send),       mrb_zmq_msg_send,       MRB_ARGS_REQ(3));
+  mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(msg_try_send),   mrb_zmq_msg_try_send,   MRB_ARGS_REQ(3));
+  mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(msg_send_many),  mrb_zmq_msg_send_many,  MRB_ARGS_REQ(3));
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(msg_size),       mrb_zmq_msg_size,       MRB_ARGS_REQ(1));
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(proxy),          mrb_zmq_proxy,          MRB_ARGS_ARG(2, 1));
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(proxy_steerable),mrb_zmq_proxy_steerable,MRB_ARGS_ARG(3, 1));
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(send),           mrb_zmq_send,           MRB_ARGS_REQ(3));
+  mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(send_multipart), mrb_zmq_send_multipart, MRB_ARGS_REQ(3));
+  mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(send_zero_copy), mrb_zmq_send_zero_copy, MRB_ARGS_REQ(3));
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(setsockopt),     mrb_zmq_setsockopt,     MRB_ARGS_REQ(3));
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(socket_monitor), mrb_zmq_socket_monitor, MRB_ARGS_REQ(3));
+  #ifdef ZMQ_CURRENT_EVENT_VERSION
+  mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(socket_monitor_versioned), mrb_zmq_socket_monitor_versioned, MRB_ARGS_ARG(4, 1));
+  #endif
   mrb_define_module_function_id(mrb, libzmq_mod, MRB_SYM(unbind),         mrb_zmq_unbind,         MRB_ARGS_REQ(2));
 
   #ifdef ZMQ_HAS_CAPABILITIES
@@ -1113,24 +4352,129 @@ mrb_mruby_zmq_gem_init(mrb_state* mrb)
 
   // ZMQ module
   zmq_mod = mrb_define_module_id(mrb, MRB_SYM(ZMQ));
+  state->zmq_mod = zmq_mod;
+
+
+  // ZMQ::Context
+  struct RClass *zmq_context_class =
+      mrb_define_class_under_id(mrb, zmq_mod, MRB_SYM(Context), mrb->object_class);
+  MRB_SET_INSTANCE_TT(zmq_context_class, MRB_TT_DATA);
+
+  mrb_define_method_id(mrb, zmq_context_class, MRB_SYM(initialize), mrb_zmq_context_new,    MRB_ARGS_OPT(1));
+  mrb_define_method_id(mrb, zmq_context_class, MRB_SYM(get),        mrb_zmq_context_get,    MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, zmq_context_class, MRB_SYM(set),        mrb_zmq_context_set,    MRB_ARGS_REQ(2));
+  mrb_define_method_id(mrb, zmq_context_class, MRB_SYM(close),      mrb_zmq_context_close,  MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_context_class, MRB_SYM_Q(closed),   mrb_zmq_context_closed, MRB_ARGS_NONE()); // closed?
 
 
   // ZMQ::Msg
   zmq_msg_class = mrb_define_class_under_id(mrb, zmq_mod, MRB_SYM(Msg), mrb->object_class);
+  state->zmq_msg_class = zmq_msg_class;
   MRB_SET_INSTANCE_TT(zmq_msg_class, MRB_TT_DATA);
 
+  mrb_define_class_method_id(mrb, zmq_msg_class, MRB_SYM(wrap),      mrb_zmq_msg_wrap,  MRB_ARGS_REQ(1));
+  mrb_define_class_method_id(mrb, zmq_msg_class, MRB_SYM(pack),      mrb_zmq_msg_pack,  MRB_ARGS_REQ(1));
   mrb_define_method_id(mrb, zmq_msg_class, MRB_SYM(initialize),      mrb_zmq_msg_new,   MRB_ARGS_OPT(1));
   mrb_define_method_id(mrb, zmq_msg_class, MRB_SYM(initialize_copy), mrb_zmq_msg_copy,  MRB_ARGS_REQ(1));
   mrb_define_method_id(mrb, zmq_msg_class, MRB_SYM(to_str),          mrb_zmq_msg_to_str,MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_msg_class, MRB_SYM(view),            mrb_zmq_msg_view,  MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_msg_class, MRB_SYM_B(close),         mrb_zmq_msg_release, MRB_ARGS_NONE()); // close!
+  mrb_define_method_id(mrb, zmq_msg_class, MRB_SYM(release),         mrb_zmq_msg_release, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_msg_class, MRB_SYM(unpack),          mrb_zmq_msg_unpack,MRB_ARGS_NONE());
   mrb_define_method_id(mrb, zmq_msg_class, MRB_OPSYM(eq),            mrb_zmq_msg_eql,   MRB_ARGS_REQ(1)); // ==
 
 
   // ZMQ::Socket
   zmq_socket_class = mrb_define_class_under_id(mrb, zmq_mod, MRB_SYM(Socket), mrb->object_class);
+  state->zmq_socket_class = zmq_socket_class;
   MRB_SET_INSTANCE_TT(zmq_socket_class, MRB_TT_DATA);
 
-  mrb_define_method_id(mrb, zmq_socket_class, MRB_SYM(initialize), mrb_zmq_socket,     MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, zmq_socket_class, MRB_SYM(initialize), mrb_zmq_socket,     (MRB_ARGS_REQ(1)|MRB_ARGS_KEY(2, 0)));
   mrb_define_method_id(mrb, zmq_socket_class, MRB_SYM(recv),       mrb_zmq_socket_recv,MRB_ARGS_OPT(1));
+  mrb_define_method_id(mrb, zmq_socket_class, MRB_SYM(try_recv),   mrb_zmq_socket_try_recv, MRB_ARGS_OPT(1));
+  mrb_define_method_id(mrb, zmq_socket_class, MRB_SYM(try_send),   mrb_zmq_socket_try_send, MRB_ARGS_ARG(1, 1));
+  mrb_define_method_id(mrb, zmq_socket_class, MRB_SYM(recv_many),  mrb_zmq_socket_recv_many, MRB_ARGS_ARG(1, 1));
+  mrb_define_method_id(mrb, zmq_socket_class, MRB_SYM(recv_into),  mrb_zmq_socket_recv_into, MRB_ARGS_ARG(1, 1));
+  mrb_define_method_id(mrb, zmq_socket_class, MRB_SYM(recv_multipart_into), mrb_zmq_socket_recv_multipart_into, MRB_ARGS_ARG(1, 1));
+  mrb_zmq_define_sockopts(mrb, zmq_socket_class);
+#ifdef MRB_ZMQ_STATS
+  mrb_define_method_id(mrb, zmq_socket_class, MRB_SYM(stats),      mrb_zmq_socket_stats_m, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_socket_class, MRB_SYM(__stats__),  mrb_zmq_socket_stats_active, MRB_ARGS_NONE());
+  mrb_define_module_function_id(mrb, zmq_mod, MRB_SYM(poller_stats), mrb_zmq_poller_stats, MRB_ARGS_NONE());
+#endif
+
+
+  // ZMQ::Socket::Monitor
+  struct RClass *zmq_monitor_class =
+      mrb_define_class_under_id(mrb, zmq_socket_class, MRB_SYM(Monitor), mrb->object_class);
+
+  mrb_define_method_id(mrb, zmq_monitor_class, MRB_SYM(recv), mrb_zmq_monitor_recv, MRB_ARGS_OPT(1));
+
+  struct RClass *zmq_monitor_counters_class =
+      mrb_define_class_under_id(mrb, zmq_monitor_class, MRB_SYM(Counters), mrb->object_class);
+  MRB_SET_INSTANCE_TT(zmq_monitor_counters_class, MRB_TT_DATA);
+
+  mrb_define_method_id(mrb, zmq_monitor_counters_class, MRB_SYM(initialize), mrb_zmq_monitor_counters_new,    MRB_ARGS_REQ(2));
+  mrb_define_method_id(mrb, zmq_monitor_counters_class, MRB_SYM(to_h),       mrb_zmq_monitor_counters_to_h,   MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_monitor_counters_class, MRB_SYM(stop),       mrb_zmq_monitor_counters_stop_m, MRB_ARGS_NONE());
+
+
+  // ZMQ::Z85
+  struct RClass *zmq_z85_mod = mrb_define_module_under_id(mrb, zmq_mod, MRB_SYM(Z85));
+  mrb_define_module_function_id(mrb, zmq_z85_mod, MRB_SYM(encode),      mrb_zmq_z85_encode_m,    MRB_ARGS_ARG(1, 1));
+  mrb_define_module_function_id(mrb, zmq_z85_mod, MRB_SYM(decode),      mrb_zmq_z85_decode_m,    MRB_ARGS_ARG(1, 1));
+  mrb_define_module_function_id(mrb, zmq_z85_mod, MRB_SYM(encode_into), mrb_zmq_z85_encode_into, MRB_ARGS_ARG(2, 1));
+  mrb_define_module_function_id(mrb, zmq_z85_mod, MRB_SYM(decode_into), mrb_zmq_z85_decode_into, MRB_ARGS_ARG(2, 1));
+
+
+  // ZMQ::Zap
+  struct RClass *zmq_zap_class = mrb_define_class_under_id(mrb, zmq_mod, MRB_SYM(Zap), mrb->object_class);
+  MRB_SET_INSTANCE_TT(zmq_zap_class, MRB_TT_DATA);
+
+  mrb_define_method_id(mrb, zmq_zap_class, MRB_SYM(__setup__),     mrb_zmq_zap_setup,         MRB_ARGS_OPT(1));
+  mrb_define_method_id(mrb, zmq_zap_class, MRB_SYM(__allowlist__), mrb_zmq_zap_set_allowlist, MRB_ARGS_REQ(2));
+  mrb_define_method_id(mrb, zmq_zap_class, MRB_SYM(handle_zap),    mrb_zmq_zap_handle,        MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_zap_class, MRB_SYM(clear_cache),   mrb_zmq_zap_clear_cache,   MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_zap_class, MRB_SYM(stats),         mrb_zmq_zap_stats,         MRB_ARGS_NONE());
+
+
+  // ZMQ::Logger
+  struct RClass *zmq_logger_class = mrb_define_class_under_id(mrb, zmq_mod, MRB_SYM(Logger), mrb->object_class);
+  struct RClass *zmq_logger_buffer_class =
+      mrb_define_class_under_id(mrb, zmq_logger_class, MRB_SYM(Buffer), mrb->object_class);
+  MRB_SET_INSTANCE_TT(zmq_logger_buffer_class, MRB_TT_DATA);
+
+  mrb_define_method_id(mrb, zmq_logger_buffer_class, MRB_SYM(initialize), mrb_zmq_logger_new,     MRB_ARGS_ARG(2, 4));
+  mrb_define_method_id(mrb, zmq_logger_buffer_class, MRB_SYM(push),       mrb_zmq_logger_push,    MRB_ARGS_REQ(2));
+  mrb_define_method_id(mrb, zmq_logger_buffer_class, MRB_SYM(flush),      mrb_zmq_logger_flush_m, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_logger_buffer_class, MRB_SYM(stats),      mrb_zmq_logger_stats,   MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_logger_buffer_class, MRB_SYM(close),      mrb_zmq_logger_close,   MRB_ARGS_NONE());
+
+
+  // ZMQ::Proxy
+  struct RClass *zmq_proxy_class =
+      mrb_define_class_under_id(mrb, zmq_mod, MRB_SYM(Proxy), mrb->object_class);
+  MRB_SET_INSTANCE_TT(zmq_proxy_class, MRB_TT_DATA);
+
+  mrb_define_method_id(mrb, zmq_proxy_class, MRB_SYM(initialize), mrb_zmq_proxy_new,       MRB_ARGS_ARG(2, 1));
+  mrb_define_method_id(mrb, zmq_proxy_class, MRB_SYM(pause),      mrb_zmq_proxy_pause,     MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_proxy_class, MRB_SYM(resume),     mrb_zmq_proxy_resume,    MRB_ARGS_NONE());
+  #if ZMQ_VERSION >= ZMQ_MAKE_VERSION(4,3,0)
+  mrb_define_method_id(mrb, zmq_proxy_class, MRB_SYM(statistics), mrb_zmq_proxy_statistics,MRB_ARGS_NONE());
+  #endif
+  mrb_define_method_id(mrb, zmq_proxy_class, MRB_SYM(terminate),  mrb_zmq_proxy_terminate, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_proxy_class, MRB_SYM_Q(running),  mrb_zmq_proxy_running_p, MRB_ARGS_NONE()); // running?
+
+
+  // ZMQ::Thread
+  struct RClass *zmq_thread_class =
+      mrb_define_class_under_id(mrb, zmq_mod, MRB_SYM(Thread), mrb->object_class);
+  state->zmq_thread_class = zmq_thread_class;
+  MRB_SET_INSTANCE_TT(zmq_thread_class, MRB_TT_DATA);
+
+  mrb_define_method_id(mrb, zmq_thread_class, MRB_SYM(__start__), mrb_zmq_thread_start, MRB_ARGS_REQ(3));
+  mrb_define_method_id(mrb, zmq_thread_class, MRB_SYM(__join__),  mrb_zmq_thread_join,  MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_thread_class, MRB_SYM_Q(alive),   mrb_zmq_thread_alive, MRB_ARGS_NONE()); // alive?
 
 
   // ZMQ::Poller
@@ -1154,6 +4498,9 @@ mrb_mruby_zmq_gem_init(mrb_state* mrb)
   mrb_define_method_id(mrb, zmq_poller_class, MRB_SYM(modify),     mrb_zmq_poller_modify,MRB_ARGS_REQ(2));
   mrb_define_method_id(mrb, zmq_poller_class, MRB_SYM(remove),     mrb_zmq_poller_remove,MRB_ARGS_REQ(1));
   mrb_define_method_id(mrb, zmq_poller_class, MRB_SYM(wait),       mrb_zmq_poller_wait,  (MRB_ARGS_OPT(1)|MRB_ARGS_BLOCK()));
+  mrb_define_method_id(mrb, zmq_poller_class, MRB_SYM(wait_all),   mrb_zmq_poller_wait_all, MRB_ARGS_OPT(1));
+  mrb_define_method_id(mrb, zmq_poller_class, MRB_SYM(ready_events), mrb_zmq_poller_ready_events, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_poller_class, MRB_SYM(size),       mrb_zmq_poller_size,  MRB_ARGS_NONE());
   #endif
 
 
@@ -1162,6 +4509,7 @@ mrb_mruby_zmq_gem_init(mrb_state* mrb)
   struct RClass *zmq_timers_class, *zmq_timers_timer_fn_class;
 
   zmq_timers_class = mrb_define_class_under_id(mrb, zmq_mod, MRB_SYM(Timers), mrb->object_class);
+  state->zmq_timers_class = zmq_timers_class;
   MRB_SET_INSTANCE_TT(zmq_timers_class, MRB_TT_DATA);
 
   mrb_define_method_id(mrb, zmq_timers_class, MRB_SYM(initialize), mrb_zmq_timers_new,    MRB_ARGS_NONE());
@@ -1183,6 +4531,28 @@ mrb_mruby_zmq_gem_init(mrb_state* mrb)
   #endif
 
 
+  // ZMQ::Reactor
+  #if defined(ZMQ_HAVE_POLLER) && defined(ZMQ_HAVE_TIMERS)
+  struct RClass *zmq_reactor_class =
+      mrb_define_class_under_id(mrb, zmq_mod, MRB_SYM(Reactor), zmq_poller_class);
+  MRB_SET_INSTANCE_TT(zmq_reactor_class, MRB_TT_DATA);
+
+  mrb_define_method_id(mrb, zmq_reactor_class, MRB_SYM(initialize), mrb_zmq_reactor_new,      MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_reactor_class, MRB_SYM(add),        mrb_zmq_reactor_add,      (MRB_ARGS_ARG(1, 1)|MRB_ARGS_BLOCK()));
+  mrb_define_method_id(mrb, zmq_reactor_class, MRB_SYM(remove),     mrb_zmq_reactor_remove,   MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, zmq_reactor_class, MRB_SYM(timers),     mrb_zmq_reactor_timers,   MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_reactor_class, MRB_SYM(run_once),   mrb_zmq_reactor_run_once, MRB_ARGS_OPT(1));
+  mrb_define_method_id(mrb, zmq_reactor_class, MRB_SYM(run),        mrb_zmq_reactor_run,      MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, zmq_reactor_class, MRB_SYM(stop),       mrb_zmq_reactor_stop,     MRB_ARGS_NONE());
+  #endif
+
+
+  mrb_define_module_function_id(mrb, zmq_mod, MRB_SYM(msg_pool_stats), mrb_zmq_msg_pool_stats,   MRB_ARGS_NONE());
+  mrb_define_module_function_id(mrb, zmq_mod, MRB_SYM_E(msg_pool_max), mrb_zmq_msg_pool_set_max, MRB_ARGS_REQ(1)); // msg_pool_max=
+  mrb_define_module_function_id(mrb, zmq_mod, MRB_SYM(live_msg_bytes), mrb_zmq_live_msg_bytes,  MRB_ARGS_NONE());
+  mrb_define_module_function_id(mrb, zmq_mod, MRB_SYM(gc_pressure_limit), mrb_zmq_gc_pressure_limit, MRB_ARGS_NONE());
+  mrb_define_module_function_id(mrb, zmq_mod, MRB_SYM_E(gc_pressure_limit), mrb_zmq_gc_pressure_set_limit, MRB_ARGS_REQ(1)); // gc_pressure_limit=
+
   #ifdef HAVE_IFADDRS_H
   mrb_define_module_function_id(mrb, zmq_mod, MRB_SYM(network_interfaces),
                                 mrb_network_interfaces, MRB_ARGS_NONE());
@@ -1200,9 +4570,34 @@ mrb_mruby_zmq_gem_init(mrb_state* mrb)
 void
 mrb_mruby_zmq_gem_final(mrb_state* mrb)
 {
-  mrb_value foreigen_context = mrb_const_get(mrb, mrb_obj_value(mrb_module_get_id(mrb, MRB_SYM(LibZMQ))), MRB_SYM(__foreigen_context__));
-  if (!mrb_bool(foreigen_context)) {
+  mrb_zmq_state_t *state = mrb_zmq_get_state(mrb);
+  // proxies, loggers and monitor counters own sockets no ZMQ::Socket knows about, they have to be closed before any context can be terminated.
+  mrb_value proxies = mrb_hash_values(mrb, state->proxies);
+  for (mrb_int i = 0; i < RARRAY_LEN(proxies); i++) {
+    mrb_zmq_proxy_stop((mrb_zmq_proxy_t *) DATA_PTR(mrb_ary_ref(mrb, proxies, i)));
+  }
+  mrb_zmq_loggers_stop(mrb, state);
+  mrb_value monitor_counters = mrb_hash_values(mrb, state->monitor_counters);
+  for (mrb_int i = 0; i < RARRAY_LEN(monitor_counters); i++) {
+    mrb_zmq_monitor_counters_stop((mrb_zmq_monitor_counters_t *) DATA_PTR(mrb_ary_ref(mrb, monitor_counters, i)));
+  }
+  // threads which weren't joined get TERM, the context shutdown interrupts those which don't read their pipe.
+  mrb_value threads = mrb_hash_keys(mrb, state->threads);
+  for (mrb_int i = 0; i < RARRAY_LEN(threads); i++) {
+    mrb_zmq_thread_t *thread = (mrb_zmq_thread_t *) (intptr_t) mrb_integer(mrb_ary_ref(mrb, threads, i));
+    if (thread->pipe->data && !thread->finished.load(std::memory_order_acquire)) {
+      zmq_send(thread->pipe->data, MRB_ZMQ_THREAD_TERM, sizeof(MRB_ZMQ_THREAD_TERM) - 1, ZMQ_DONTWAIT);
+    }
+  }
+  mrb_value contexts = mrb_hash_values(mrb, state->contexts);
+  for (mrb_int i = 0; i < RARRAY_LEN(contexts); i++) {
+    mrb_zmq_context_shutdown_close_and_term(mrb, mrb_ary_ref(mrb, contexts, i));
+  }
+  if (!state->foreign_context) {
     mrb_zmq_ctx_shutdown_close_and_term(mrb);
   }
+  for (mrb_int i = 0; i < RARRAY_LEN(threads); i++) {
+    mrb_zmq_thread_close(mrb, state, (mrb_zmq_thread_t *) (intptr_t) mrb_integer(mrb_ary_ref(mrb, threads, i)));
+  }
 }
 MRB_END_DECL
\ No newline at end of file
@@ -20,6 +20,7 @@
 #include <mruby/gc.h>
 #include <mruby/numeric.h>
 #include <mruby/proc.h>
+#include <mruby/compile.h>
 #ifdef HAVE_IFADDRS_H
 #include <arpa/inet.h>
 #include <net/if.h>
@@ -30,6 +31,15 @@
 #include <mruby/branch_pred.h>
 #include <vector>
 #include <cstddef>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <condition_variable>
+#include <chrono>
+#include <time.h>
 
 #define NELEMS(args) (sizeof(args) / sizeof(args[0]))
 
@@ -44,15 +54,172 @@
 #endif
 
 
-#define MRB_LIBZMQ_CONTEXT(mrb) (mrb_cptr(mrb_const_get(mrb, mrb_obj_value(mrb_module_get_id(mrb, MRB_SYM(LibZMQ))), MRB_SYM(__CTX__))))
+// Strings smaller than this are copied even when a zero copy msg was requested,
+// pinning them costs more than a memcpy.
+#ifndef MRB_ZMQ_ZERO_COPY_MIN_SIZE
+#define MRB_ZMQ_ZERO_COPY_MIN_SIZE 1024
+#endif
+
+// how many free zmq_msg_t slots each mrb_state keeps around for new ZMQ::Msg objects,
+// can be overridden with the ZMQ_MSG_POOL_MAX env var or ZMQ.msg_pool_max=
+#ifndef MRB_ZMQ_MSG_POOL_MAX
+#define MRB_ZMQ_MSG_POOL_MAX 1024
+#endif
+
+// the mruby GC only sees the RData of a ZMQ::Msg, not its payload.
+// Once the live payload bytes grew this much above their lowest point since the last one a full GC gets started,
+// can be overridden with the ZMQ_GC_PRESSURE_BYTES env var or ZMQ.gc_pressure_limit=, 0 turns it off.
+#ifndef MRB_ZMQ_GC_PRESSURE_BYTES
+#define MRB_ZMQ_GC_PRESSURE_BYTES (64 * 1024 * 1024)
+#endif
+
+// how deep Arrays and Hashes may be nested in Msg.pack, this also stops it on recursive structures
+#ifndef MRB_ZMQ_PACK_MAX_DEPTH
+#define MRB_ZMQ_PACK_MAX_DEPTH 64
+#endif
+
+#define MRB_LIBZMQ_CONTEXT(mrb) (mrb_zmq_get_state(mrb)->context)
+
+// Hash key for registries of native objects
+MRB_INLINE mrb_value
+mrb_zmq_ptr_key(mrb_state *mrb, void *ptr)
+{
+  return mrb_int_value(mrb, (mrb_int) (intptr_t) ptr);
+}
+
+// libzmq calls the free function of zero copy msgs from whichever thread drops the last reference,
+// which is usually one of its io threads. Released pins are queued here and unpinned on the mruby thread.
+// The reaper is refcounted because msgs can outlive the mrb_state when a foreign context is used.
+typedef struct {
+  std::mutex mutex;
+  std::vector<mrb_int> released;
+  std::atomic<bool> pending;
+  std::atomic<int> refcount;
+} mrb_zmq_reaper_t;
+
+typedef struct {
+  mrb_zmq_reaper_t *reaper;
+  mrb_int token;
+} mrb_zmq_zero_copy_hint_t;
+
+// free list of zmq_msg_t slots for ZMQ::Msg objects.
+// Msgs can be swept after the state object while mruby shuts down,
+// so the pool stays around until the last slot has been returned.
+typedef struct mrb_zmq_msg_pool_t {
+  struct mrb_zmq_msg_slot_t *free_list;
+  mrb_int size;
+  mrb_int max;
+  mrb_int live;
+  mrb_int hits;
+  mrb_int misses;
+  mrb_int drops;
+  size_t live_bytes; // payload bytes held by live ZMQ::Msg objects
+  size_t baseline; // lowest live_bytes since the last full GC we started
+  size_t pressure_limit;
+  mrb_bool closed;
+} mrb_zmq_msg_pool_t;
+
+typedef struct mrb_zmq_msg_slot_t {
+  mrb_zmq_msg_pool_t *pool;
+  size_t bytes; // payload size accounted in pool->live_bytes
+  union {
+    zmq_msg_t msg;
+    struct mrb_zmq_msg_slot_t *next; // while the slot sits in the free list
+  } u;
+} mrb_zmq_msg_slot_t;
+
+#ifdef MRB_ZMQ_STATS
+// a HDR style histogram of nanoseconds, every power of two is split into 4 linear sub buckets,
+// so a bucket is at most 25% wider than its lower bound.
+#define MRB_ZMQ_HISTOGRAM_SUB_BITS 2
+#define MRB_ZMQ_HISTOGRAM_BUCKETS ((64 - MRB_ZMQ_HISTOGRAM_SUB_BITS + 1) << MRB_ZMQ_HISTOGRAM_SUB_BITS)
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[MRB_ZMQ_HISTOGRAM_BUCKETS];
+} mrb_zmq_histogram_t;
+#endif
+
+// everything the hot paths would otherwise look up by name, one per mrb_state.
+// Symbols need no caching, MRB_SYM resolves them at compile time.
+typedef struct {
+  void *context;
+  mrb_bool foreign_context;
+  uint64_t socket_affinity; // ZMQ_AFFINITY for new sockets, from the ZMQ_AFFINITY env var
+  struct RClass *libzmq_mod;
+  struct RClass *zmq_mod;
+  struct RClass *zmq_msg_class;
+  struct RClass *zmq_socket_class;
+  struct RClass *zmq_timers_class;
+  struct RClass *zmq_thread_class;
+  mrb_value contexts; // ZMQ::Context objects which haven't been closed yet
+  mrb_value proxies; // running ZMQ::Proxy objects
+  mrb_value monitor_counters; // running ZMQ::Socket::Monitor::Counters objects
+  mrb_value loggers; // ZMQ::Logger::Buffer objects with a socket or a flush thread
+  mrb_value threads; // parent pipes of ZMQ::Threads which haven't been joined yet
+  mrb_zmq_reaper_t *reaper;
+  mrb_value pins; // token => String, kept alive as a ivar of the state object
+  mrb_int pin_seq;
+  mrb_zmq_msg_pool_t *msg_pool;
+#ifdef MRB_ZMQ_STATS
+  mrb_zmq_histogram_t poll_wait; // how long Poller waits blocked
+#endif
+} mrb_zmq_state_t;
+
+MRB_INLINE mrb_zmq_msg_slot_t *
+mrb_zmq_msg_slot(zmq_msg_t *msg)
+{
+  return (mrb_zmq_msg_slot_t *) ((char *) msg - offsetof(mrb_zmq_msg_slot_t, u));
+}
+
+MRB_INLINE void
+mrb_zmq_reaper_unref(mrb_zmq_reaper_t *reaper)
+{
+  if (reaper->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete reaper;
+  }
+}
+
+// defined in mrb_libzmq.cc
+static void mrb_zmq_msg_pool_close(mrb_state *mrb, mrb_zmq_msg_pool_t *pool);
+
+static void
+mrb_zmq_gc_state_free(mrb_state *mrb, void *state_)
+{
+  mrb_zmq_state_t *state = (mrb_zmq_state_t *) state_;
+  mrb_zmq_reaper_unref(state->reaper);
+  mrb_zmq_msg_pool_close(mrb, state->msg_pool);
+  mrb_free(mrb, state);
+}
+
+static const struct mrb_data_type mrb_zmq_state_type = {
+  "$i_mrb_zmq_state_type", mrb_zmq_gc_state_free
+};
+
+MRB_INLINE mrb_zmq_state_t *
+mrb_zmq_get_state(mrb_state *mrb)
+{
+  return (mrb_zmq_state_t *) DATA_PTR(mrb_gv_get(mrb, MRB_SYM(__mrb_zmq_state__)));
+}
+
+// which sockets mrb_zmq_zmq_close_gem_final closes
+typedef struct {
+  struct RClass *socket_class;
+  mrb_value context; // the ZMQ::Context they were created with, nil for the default context
+} mrb_zmq_close_sockets_t;
 
 #ifdef MRB_EACH_OBJ_OK
 static int
 #else
 static void
 #endif
-mrb_zmq_zmq_close_gem_final(mrb_state *mrb, struct RBasic *obj, void *socket_class)
+mrb_zmq_zmq_close_gem_final(mrb_state *mrb, struct RBasic *obj, void *close_sockets_)
 {
+  mrb_zmq_close_sockets_t *close_sockets = (mrb_zmq_close_sockets_t *) close_sockets_;
+
   /* filter dead objects */
   if (mrb_object_dead_p(mrb, obj)) {
 #ifdef MRB_EACH_OBJ_OK
@@ -85,7 +252,8 @@ mrb_zmq_zmq_close_gem_final(mrb_state *mrb, struct RBasic *obj, void *socket_cla
   }
 
   mrb_value socket_val = mrb_obj_value(obj);
-  if (mrb_obj_is_kind_of(mrb, socket_val, (struct RClass *)socket_class)) {
+  if (mrb_obj_is_kind_of(mrb, socket_val, close_sockets->socket_class) &&
+      mrb_obj_eq(mrb, mrb_iv_get(mrb, socket_val, MRB_SYM(context)), close_sockets->context)) {
     void *socket = DATA_PTR(socket_val);
     if (socket) {
       int wait500ms = 500; // we wait up to 500 miliseconds for each socket to close when mruby is closed via mrb_close(mrb).
@@ -99,15 +267,93 @@ mrb_zmq_zmq_close_gem_final(mrb_state *mrb, struct RBasic *obj, void *socket_cla
 #endif
 }
 
+#ifndef MRB_ZMQ_LOGGER_INTERVAL
+#define MRB_ZMQ_LOGGER_INTERVAL 100
+#endif
+
+#ifndef MRB_ZMQ_LOGGER_BATCH
+#define MRB_ZMQ_LOGGER_BATCH 64
+#endif
+
+#ifndef MRB_ZMQ_LOGGER_CAPACITY
+#define MRB_ZMQ_LOGGER_CAPACITY 4096
+#endif
+
+typedef struct {
+  char level;
+  time_t time;
+  std::string message;
+} mrb_zmq_logger_entry_t;
+
+// ZMQ::Logger entries are queued by the mruby thread and written by a flush thread,
+// every interval ms or as soon as batch entries are waiting, one frame per batch.
+// The slots of both buffers are reused, so their Strings keep their capacity.
+typedef struct {
+  void *handle; // from zmq_threadstart, NULL until the first entry and once stopped
+  void *socket; // the Pub socket, NULL when only writing to stdout
+  bool stdout_;
+  bool closed;
+  std::string ident;
+  int interval;
+  size_t batch;
+  std::mutex mutex; // guards pending, used and stop
+  std::condition_variable wakeup;
+  std::vector<mrb_zmq_logger_entry_t> pending;
+  size_t used;
+  bool stop;
+  std::mutex write_mutex; // guards everything below, held while a batch is written
+  std::vector<mrb_zmq_logger_entry_t> writing;
+  std::string frame;
+  time_t formatted_at;
+  char formatted[32]; // the timestamp of formatted_at, only redone when the second changes
+  std::atomic<uint64_t> written;
+  std::atomic<uint64_t> dropped;
+  std::atomic<uint64_t> batches;
+} mrb_zmq_logger_t;
+
+// defined in mrb_libzmq.cc
+static void mrb_zmq_logger_stop(mrb_zmq_logger_t *logger);
+
+static void
+mrb_zmq_gc_logger_free(mrb_state *mrb, void *logger)
+{
+  mrb_zmq_logger_stop((mrb_zmq_logger_t *) logger);
+  delete (mrb_zmq_logger_t *) logger;
+}
+
+static const struct mrb_data_type mrb_zmq_logger_type = {
+  "$i_mrb_zmq_logger_type", mrb_zmq_gc_logger_free
+};
+
+// defined in mrb_libzmq.cc
+static void mrb_zmq_loggers_stop(mrb_state *mrb, mrb_zmq_state_t *state);
+
 MRB_API void
 mrb_zmq_ctx_shutdown_close_and_term(mrb_state* mrb)
 {
-  void *context_ = MRB_LIBZMQ_CONTEXT(mrb);
+  mrb_zmq_state_t *state = mrb_zmq_get_state(mrb);
+  void *context_ = state->context;
+  mrb_zmq_loggers_stop(mrb, state);
   zmq_ctx_shutdown(context_);
-  mrb_objspace_each_objects(mrb, mrb_zmq_zmq_close_gem_final, mrb_class_get_under_id(mrb, mrb_module_get_id(mrb, MRB_SYM(ZMQ)), MRB_SYM(Socket)));
+  mrb_zmq_close_sockets_t close_sockets = { state->zmq_socket_class, mrb_nil_value() };
+  mrb_objspace_each_objects(mrb, mrb_zmq_zmq_close_gem_final, &close_sockets);
   zmq_ctx_term(context_);
 }
 
+// ZMQ::Context objects stay registered in the state until they are closed,
+// so their sockets are always closed before the context is terminated.
+static void
+mrb_zmq_gc_context_free(mrb_state *mrb, void *context_)
+{
+  if (context_) {
+    zmq_ctx_shutdown(context_);
+  }
+}
+
+static const struct mrb_data_type mrb_zmq_context_type = {
+  "$i_mrb_zmq_context_type", mrb_zmq_gc_context_free
+};
+
 MRB_API void
 mrb_zmq_set_context(mrb_state *mrb, void *context_)
 {
@@ -115,13 +361,15 @@ mrb_zmq_set_context(mrb_state *mrb, void *context_)
   if (rc == -1) {
     mrb_sys_fail(mrb, "not a zmq context");
   }
-  mrb_value foreigen_context = mrb_const_get(mrb, mrb_obj_value(mrb_module_get_id(mrb, MRB_SYM(LibZMQ))), MRB_SYM(__foreigen_context__));
-  if (!mrb_bool(foreigen_context)) {
+  mrb_zmq_state_t *state = mrb_zmq_get_state(mrb);
+  if (!state->foreign_context) {
     mrb_zmq_ctx_shutdown_close_and_term(mrb);
   }
-  mrb_define_const_id(mrb, mrb_module_get_id(mrb, MRB_SYM(LibZMQ)), MRB_SYM(__CTX__),
+  state->context = context_;
+  state->foreign_context = TRUE;
+  mrb_define_const_id(mrb, state->libzmq_mod, MRB_SYM(__CTX__),
                       mrb_cptr_value(mrb, context_));
-  mrb_define_const_id(mrb, mrb_module_get_id(mrb, MRB_SYM(LibZMQ)), MRB_SYM(__foreigen_context__),
+  mrb_define_const_id(mrb, state->libzmq_mod, MRB_SYM(__foreigen_context__),
                       mrb_true_value());
   mrb_load_string(mrb, "ZMQ.logger = ZMQ::Logger.new(ENV['ZMQ_LOGGER_ENDPOINT'], ENV['ZMQ_LOGGER_IDENT'])");
   if (mrb->exc) {
@@ -165,22 +413,60 @@ static const struct mrb_data_type mrb_zmq_socket_type = {
   "$i_mrb_zmq_socket_type", mrb_zmq_gc_close
 };
 
+// defined in mrb_libzmq.cc
+static void mrb_zmq_msg_pool_return(mrb_state *mrb, zmq_msg_t *msg);
+
 static void
 mrb_zmq_gc_msg_close(mrb_state *mrb, void *msg)
 {
   zmq_msg_close((zmq_msg_t *) msg);
-  mrb_free(mrb, msg);
+  mrb_zmq_msg_pool_return(mrb, (zmq_msg_t *) msg);
 }
 
 static const struct mrb_data_type mrb_zmq_msg_type = {
   "$i_mrb_zmq_msg_type", mrb_zmq_gc_msg_close
 };
 
+#ifdef MRB_ZMQ_STATS
+// per socket counters, only compiled in with MRB_ZMQ_STATS defined.
+// They live in a data object in the hidden stats ivar of the socket and survive closing it.
+typedef struct {
+  uint64_t msgs_out;
+  uint64_t bytes_out;
+  uint64_t msgs_in;
+  uint64_t bytes_in;
+  uint64_t eagain;
+  uint64_t eterm;
+  uint64_t errors; // every other errno
+  mrb_zmq_histogram_t recv_wait; // how long receiving the first part blocked
+} mrb_zmq_socket_stats_t;
+
+static void
+mrb_zmq_gc_socket_stats_free(mrb_state *mrb, void *stats)
+{
+  mrb_free(mrb, stats);
+}
+
+static const struct mrb_data_type mrb_zmq_socket_stats_type = {
+  "$i_mrb_zmq_socket_stats_type", mrb_zmq_gc_socket_stats_free
+};
+
+#endif
+
 #ifdef ZMQ_HAVE_POLLER
+// the registry of polled objects lives in the sockets ivar as a Hash keyed by mrb_zmq_ptr_key,
+// events is reused by every wait and only grows with the registry.
+typedef struct {
+  void *poller;
+  std::vector<zmq_poller_event_t> events;
+} mrb_zmq_poller_t;
+
 static void
-mrb_zmq_gc_poller_destroy(mrb_state *mrb, void *poller)
+mrb_zmq_gc_poller_destroy(mrb_state *mrb, void *poller_)
 {
-  zmq_poller_destroy(&poller);
+  mrb_zmq_poller_t *poller = (mrb_zmq_poller_t *) poller_;
+  zmq_poller_destroy(&poller->poller);
+  delete poller;
 }
 
 static const struct mrb_data_type mrb_zmq_poller_type = {
@@ -215,4 +501,188 @@ static const struct mrb_data_type mrb_zmq_timers_type = {
 };
 #endif //ZMQ_HAVE_TIMERS
 
+// a ZMQ::Proxy owns its sockets once it has been started, they are used by the proxy thread only
+// and closed after it has been joined. control is the proxy end of the command pipe, pipe our end.
+typedef struct {
+  void *handle; // from zmq_threadstart, NULL once joined
+  void *frontend;
+  void *backend;
+  void *capture;
+  void *control;
+  void *pipe;
+  int rc;
+  int err;
+  std::atomic<bool> finished;
+} mrb_zmq_proxy_t;
+
+// defined in mrb_libzmq.cc
+static void mrb_zmq_proxy_stop(mrb_zmq_proxy_t *proxy);
+
+static void
+mrb_zmq_gc_proxy_free(mrb_state *mrb, void *proxy)
+{
+  mrb_zmq_proxy_stop((mrb_zmq_proxy_t *) proxy);
+  delete (mrb_zmq_proxy_t *) proxy;
+}
+
+static const struct mrb_data_type mrb_zmq_proxy_type = {
+  "$i_mrb_zmq_proxy_type", mrb_zmq_gc_proxy_free
+};
+
+// types of the socket options in zmq_sockopt.cstub, which is generated by gen_const.rb
+typedef enum {
+  MRB_ZMQ_SOCKOPT_INT,
+  MRB_ZMQ_SOCKOPT_BOOL,
+  MRB_ZMQ_SOCKOPT_INT64,
+  MRB_ZMQ_SOCKOPT_UINT64,
+  MRB_ZMQ_SOCKOPT_FD,
+  MRB_ZMQ_SOCKOPT_STRING, // NUL terminated by libzmq
+  MRB_ZMQ_SOCKOPT_BINARY
+} mrb_zmq_sockopt_type_t;
+
+#define MRB_ZMQ_SOCKOPT_R  1
+#define MRB_ZMQ_SOCKOPT_W  2
+#define MRB_ZMQ_SOCKOPT_RW (MRB_ZMQ_SOCKOPT_R | MRB_ZMQ_SOCKOPT_W)
+
+typedef struct {
+  const char *name;
+  int id;
+  mrb_zmq_sockopt_type_t type;
+  size_t max_size; // buffer size for string and binary options
+  int access;
+} mrb_zmq_sockopt_t;
+
+// a decoded socket monitor event, local and remote must be closed by whoever received it.
+// Version 1 events have no remote endpoint.
+typedef struct {
+  uint64_t event;
+  uint64_t value;
+  zmq_msg_t local;
+  zmq_msg_t remote;
+} mrb_zmq_monitor_event_t;
+
+// counts monitor events per event and local endpoint on a native thread,
+// which polls stop every MRB_ZMQ_MONITOR_COUNTERS_IVL ms.
+typedef struct {
+  void *handle; // from zmq_threadstart, NULL once joined
+  void *socket;
+  int version;
+  std::mutex mutex;
+  std::map<std::pair<uint64_t, std::string>, uint64_t> counts;
+  std::atomic<bool> stop;
+} mrb_zmq_monitor_counters_t;
+
+#ifndef MRB_ZMQ_MONITOR_COUNTERS_IVL
+#define MRB_ZMQ_MONITOR_COUNTERS_IVL 100
+#endif
+
+// defined in mrb_libzmq.cc
+static void mrb_zmq_monitor_counters_stop(mrb_zmq_monitor_counters_t *counters);
+
+static void
+mrb_zmq_gc_monitor_counters_free(mrb_state *mrb, void *counters)
+{
+  mrb_zmq_monitor_counters_stop((mrb_zmq_monitor_counters_t *) counters);
+  delete (mrb_zmq_monitor_counters_t *) counters;
+}
+
+static const struct mrb_data_type mrb_zmq_monitor_counters_type = {
+  "$i_mrb_zmq_monitor_counters_type", mrb_zmq_gc_monitor_counters_free
+};
+
+#ifndef MRB_ZMQ_ZAP_CACHE_SIZE
+#define MRB_ZMQ_ZAP_CACHE_SIZE 1024
+#endif
+
+// routing id, delimiter, version, request id, domain, address, identity, mechanism and at most two credentials
+#define MRB_ZMQ_ZAP_FRAMES 10
+
+typedef struct {
+  int status;
+  std::string user;
+  std::string metadata; // already in the zmtp property format
+} mrb_zmq_zap_decision_t;
+
+typedef std::list<std::pair<std::string, mrb_zmq_zap_decision_t> > mrb_zmq_zap_lru_t;
+
+// ZMQ::Zap answers handshakes on the mruby thread, allowlisted CURVE keys and PLAIN users
+// and cached decisions are handled without calling into ruby.
+typedef struct {
+  std::unordered_map<std::string, std::string> curve; // 32 byte public key => user id
+  std::unordered_map<std::string, std::string> plain; // username => password
+  size_t cache_max;
+  mrb_zmq_zap_lru_t lru; // most recently used first
+  std::unordered_map<std::string, mrb_zmq_zap_lru_t::iterator> cache;
+  zmq_msg_t frames[MRB_ZMQ_ZAP_FRAMES];
+  int nframes; // frames still open from the last request
+  std::string key;
+  uint64_t handshakes;
+  uint64_t allowlist_hits;
+  uint64_t cache_hits;
+  uint64_t authenticator_calls;
+  time_t second;
+  uint64_t this_second;
+  uint64_t last_second;
+} mrb_zmq_zap_t;
+
+// defined in mrb_libzmq.cc
+static void mrb_zmq_zap_close_frames(mrb_zmq_zap_t *zap);
+
+static void
+mrb_zmq_gc_zap_free(mrb_state *mrb, void *zap)
+{
+  mrb_zmq_zap_close_frames((mrb_zmq_zap_t *) zap);
+  delete (mrb_zmq_zap_t *) zap;
+}
+
+static const struct mrb_data_type mrb_zmq_zap_type = {
+  "$i_mrb_zmq_zap_type", mrb_zmq_gc_zap_free
+};
+
+// what ZMQ::Thread#kill sends, ZMQ::Thread::TERM
+#define MRB_ZMQ_THREAD_TERM "$TERM"
+
+// a ZMQ::Thread runs in its own mrb_state on a native thread,
+// the Thread object, the native thread and the threads registry of the state each hold a reference.
+// The registry keeps the parent end of the pipe open until the native thread has been joined.
+typedef struct {
+  void *handle; // from zmq_threadstart, NULL once joined
+  struct RData *pipe; // the parent Pair while the thread is registered, NULL once joined
+  void *context;
+  std::string endpoint;
+  std::string code;
+  std::string args; // the argument Array in the Msg.pack format
+  std::string result; // the return value in the Msg.pack format, empty when it couldn't be packed
+  std::string error_class;
+  std::string error_message;
+  bool failed;
+  std::atomic<bool> finished;
+  std::atomic<int> refcount;
+} mrb_zmq_thread_t;
+
+MRB_INLINE void
+mrb_zmq_thread_unref(mrb_zmq_thread_t *thread)
+{
+  if (thread->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete thread;
+  }
+}
+
+// joining here could block forever, so a thread which wasn't joined gets TERM through its pipe,
+// which the registry keeps open, and is joined by mrb_zmq_reap_threads once it finished.
+static void
+mrb_zmq_gc_thread_free(mrb_state *mrb, void *thread_)
+{
+  mrb_zmq_thread_t *thread = (mrb_zmq_thread_t *) thread_;
+  // the Pair is still registered and its socket NULL when it was closed
+  if (thread->pipe && thread->pipe->data && !thread->finished.load(std::memory_order_acquire)) {
+    zmq_send(thread->pipe->data, MRB_ZMQ_THREAD_TERM, sizeof(MRB_ZMQ_THREAD_TERM) - 1, ZMQ_DONTWAIT);
+  }
+  mrb_zmq_thread_unref(thread);
+}
+
+static const struct mrb_data_type mrb_zmq_thread_type = {
+  "$i_mrb_zmq_thread_type", mrb_zmq_gc_thread_free
+};
+
 #endif
@@ -77,3 +77,494 @@ assert('Msg') do
   ZMQ::Msg.new()
   ZMQ::Msg.new("hallo")
 end
+
+assert('Msg.wrap') do
+  pull = ZMQ::Pull.new("inproc://mrb-zmq-test-zero-copy")
+  pull.rcvtimeo = 500
+  push = ZMQ::Push.new("inproc://mrb-zmq-test-zero-copy")
+  push.sndtimeo = 500
+  payload = "a" * 4096
+  msg = ZMQ::Msg.wrap(payload)
+  assert_true(payload.frozen?)
+  assert_equal(4096, msg.bytesize)
+  msg.send(push)
+  assert_equal(payload, pull.recv.to_str)
+  big = "b" * 8192
+  assert_equal(8192, LibZMQ.send_zero_copy(push, big, 0))
+  assert_true(big.frozen?)
+  assert_equal(big, pull.recv.to_str)
+  small = "copied"
+  assert_equal(6, LibZMQ.send_zero_copy(push, small, 0))
+  assert_false(small.frozen?)
+  assert_equal(small, pull.recv.to_str)
+end
+
+assert('Msg#view') do
+  pull = ZMQ::Pull.new("inproc://mrb-zmq-test-view")
+  pull.rcvtimeo = 500
+  push = ZMQ::Push.new("inproc://mrb-zmq-test-view")
+  push.sndtimeo = 500
+  push.send("v" * 4096)
+  msg = pull.recv
+  view = msg.view
+  assert_true(view.frozen?)
+  assert_equal("v" * 4096, view)
+  assert_same(view, msg.view)
+  msg.send(push)
+  assert_equal("v" * 4096, view)
+  assert_equal(view, pull.recv.to_str)
+end
+
+assert('Socket#recv_many') do
+  pull = ZMQ::Pull.new("inproc://mrb-zmq-test-recv-many")
+  pull.rcvtimeo = 500
+  push = ZMQ::Push.new("inproc://mrb-zmq-test-recv-many")
+  push.sndtimeo = 500
+  push.send("1")
+  push.send(["2", "3"])
+  push.send("4")
+  batch = pull.recv_many(2)
+  assert_equal(2, batch.size)
+  assert_equal("1", batch[0].to_str)
+  assert_equal(["2", "3"], batch[1].map(&:to_str))
+  batch = pull.recv_many(10)
+  assert_equal(["4"], batch.map(&:to_str))
+end
+
+assert('Socket#try_send and #try_recv') do
+  pull = ZMQ::Pull.new("inproc://mrb-zmq-test-try")
+  assert_nil(pull.try_recv)
+  assert_false(ZMQ::Push.new.try_send("hallo"))
+  push = ZMQ::Push.new("inproc://mrb-zmq-test-try")
+  assert_true(push.try_send("hallo"))
+  assert_true(push.try_send(["1", "2"]))
+  msg = ZMQ::Msg.new("hallo too")
+  assert_true(push.try_send(msg))
+  assert_equal("hallo too", msg.to_str)
+  assert_true(msg.try_send(push))
+  assert_equal(0, msg.size)
+  assert_equal("hallo", pull.try_recv.to_str)
+  assert_equal(["1", "2"], pull.try_recv.map(&:to_str))
+  assert_equal("hallo too", pull.try_recv.to_str)
+  assert_equal("hallo too", pull.try_recv.to_str)
+  assert_nil(pull.try_recv)
+end
+
+assert('Msg#send_to_all') do
+  pulls = []
+  pushes = []
+  3.times do |i|
+    pulls << ZMQ::Pull.new("inproc://mrb-zmq-test-send-to-all-#{i}")
+    pushes << ZMQ::Push.new("inproc://mrb-zmq-test-send-to-all-#{i}")
+  end
+  pushes << ZMQ::Push.new
+  msg = ZMQ::Msg.new("snapshot")
+  assert_equal([8, 8, 8, nil], msg.send_to_all(pushes, LibZMQ::DONTWAIT))
+  assert_equal("snapshot", msg.to_str)
+  pulls.each { |pull| assert_equal("snapshot", pull.recv.to_str) }
+  assert_raise(TypeError) { msg.send_to_all([pushes.first, msg]) }
+  closed = ZMQ::Push.new
+  closed.close
+  assert_raise(ArgumentError) { msg.send_to_all([pushes.first, closed]) }
+  assert_nil(pulls.first.try_recv)
+  router = ZMQ::Router.new
+  router.router_mandatory = true
+  results = msg.send_to_all([router, pushes.first], LibZMQ::DONTWAIT)
+  assert_kind_of(SystemCallError, results.first)
+  assert_equal(8, results.last)
+  assert_equal("snapshot", pulls.first.recv.to_str)
+end
+
+assert('LibZMQ.send_multipart') do
+  router = ZMQ::Router.new("inproc://mrb-zmq-test-send-multipart")
+  router.rcvtimeo = 500
+  router.sndtimeo = 500
+  dealer = ZMQ::Dealer.new("inproc://mrb-zmq-test-send-multipart")
+  dealer.rcvtimeo = 500
+  dealer.sndtimeo = 500
+  dealer.send(["", "hallo"])
+  peer, empty, msg = router.recv
+  assert_equal(4, LibZMQ.send_multipart(router, [peer, empty, "hallo too", msg], 0))
+  assert_equal("hallo", msg.to_str)
+  assert_equal(["", "hallo too", "hallo"], dealer.recv.map(&:to_str))
+  assert_raise(ArgumentError) { LibZMQ.send_multipart(router, [], 0) }
+end
+
+assert('ZMQ.msg_pool_stats') do
+  ZMQ::Msg.new("pooled")
+  GC.start
+  ZMQ::Msg.new("pooled")
+  stats = ZMQ.msg_pool_stats
+  assert_kind_of(Integer, stats[:hits])
+  assert_kind_of(Integer, stats[:misses])
+  assert_true(stats[:hits] + stats[:misses] > 0)
+  max = stats[:max]
+  ZMQ.msg_pool_max = 0
+  assert_equal(0, ZMQ.msg_pool_stats[:size])
+  ZMQ.msg_pool_max = max
+end
+
+assert('Msg#close!') do
+  before = ZMQ.live_msg_bytes
+  msg = ZMQ::Msg.new("r" * 8192)
+  assert_equal(before + 8192, ZMQ.live_msg_bytes)
+  assert_same(msg, msg.close!)
+  assert_equal(0, msg.size)
+  assert_equal("", msg.to_str)
+  assert_equal(before, ZMQ.live_msg_bytes)
+  msg = ZMQ::Msg.new("r" * 8192)
+  view = msg.view
+  copy = msg.dup
+  assert_equal(before + 8192, ZMQ.live_msg_bytes)
+  copy.release
+  msg.release
+  assert_equal(0, msg.size)
+  assert_equal("r" * 8192, view)
+  assert_equal("r" * 16, view.byteslice(0, 16))
+end
+
+assert('ZMQ.gc_pressure_limit') do
+  limit = ZMQ.gc_pressure_limit
+  GC.start
+  before = ZMQ.live_msg_bytes
+  ZMQ.gc_pressure_limit = 64 * 1024
+  assert_equal(64 * 1024, ZMQ.gc_pressure_limit)
+  # every msg is unreachable right after it was created, the pressure triggered GCs collect them
+  32.times { ZMQ::Msg.new("r" * 8192) }
+  assert_true(ZMQ.live_msg_bytes - before < 32 * 8192)
+  # released payloads never add up to pressure
+  32.times { ZMQ::Msg.new("r" * 8192).close! }
+  assert_true(ZMQ.live_msg_bytes - before < 32 * 8192)
+  ZMQ.gc_pressure_limit = limit
+end
+
+assert('Socket#recv_into') do
+  pull = ZMQ::Pull.new("inproc://mrb-zmq-test-recv-into")
+  pull.rcvtimeo = 500
+  push = ZMQ::Push.new("inproc://mrb-zmq-test-recv-into")
+  push.sndtimeo = 500
+  buffer = String.new
+  push.send("hallo ballo")
+  assert_equal(11, pull.recv_into(buffer))
+  assert_equal("hallo ballo", buffer)
+  assert_false(pull.rcvmore?)
+  push.send("hi")
+  assert_equal(2, pull.recv_into(buffer))
+  assert_equal("hi", buffer)
+  assert_raise(FrozenError) { pull.recv_into("frozen".freeze) }
+
+  buffers = [String.new]
+  push.send(["a", "bb", "ccc"])
+  assert_equal(3, pull.recv_multipart_into(buffers))
+  assert_equal(["a", "bb", "ccc"], buffers)
+  push.send(["d", "e"])
+  assert_equal(2, pull.recv_multipart_into(buffers))
+  assert_equal(["d", "e"], buffers[0, 2])
+end
+
+if ZMQ.const_defined?("Poller")
+  assert('Poller#wait_all') do
+    pull = ZMQ::Pull.new("inproc://mrb-zmq-test-poller")
+    push = ZMQ::Push.new("inproc://mrb-zmq-test-poller")
+    poller = ZMQ::Poller.new
+    poller << pull
+    assert_equal(1, poller.size)
+    assert_nil(poller.wait_all(0))
+    push.send("hallo")
+    ready = poller.wait_all(500)
+    assert_equal([pull], ready)
+    assert_equal([ZMQ::Poller::In], poller.ready_events)
+    assert_same(ready, poller.wait_all(0))
+    pull.recv
+    poller.remove(pull)
+    assert_equal(0, poller.size)
+  end
+end
+
+if ZMQ.const_defined?("Reactor")
+  assert('Reactor#run_once') do
+    pull = ZMQ::Pull.new("inproc://mrb-zmq-test-reactor")
+    push = ZMQ::Push.new("inproc://mrb-zmq-test-reactor")
+    reactor = ZMQ::Reactor.new
+    received = []
+    reactor.add(pull) { |socket, events| received << socket.recv.to_str }
+    fired = 0
+    reactor.timers.add(1) { fired += 1 }
+    push.send("hallo")
+    assert_equal(1, reactor.run_once(500))
+    assert_equal(["hallo"], received)
+    reactor.run_once(500) while fired == 0
+    assert_equal(1, fired)
+    reactor.remove(pull)
+    assert_equal(0, reactor.size)
+  end
+
+  assert('Reactor#run with a raising handler') do
+    pull = ZMQ::Pull.new("inproc://mrb-zmq-test-reactor-raise")
+    push = ZMQ::Push.new("inproc://mrb-zmq-test-reactor-raise")
+    reactor = ZMQ::Reactor.new
+    reactor.add(pull) { |socket, events| socket.recv; raise ArgumentError, "boom" }
+    push.send("hallo")
+    assert_raise(ArgumentError) { reactor.run }
+    reactor.remove(pull)
+    assert_same(reactor, reactor.run)
+  end
+end
+
+assert('ZMQ::Context') do
+  context = ZMQ::Context.new(io_threads: 2)
+  assert_equal(2, context.io_threads)
+  pull = ZMQ::Pull.new("inproc://mrb-zmq-test-context", context: context)
+  push = ZMQ::Push.new("inproc://mrb-zmq-test-context", context: context)
+  push.send("hallo")
+  assert_equal("hallo", pull.recv.to_str)
+  context.close
+  assert_true(context.closed?)
+  assert_raise(Errno::ENOTSOCK) { pull.recv }
+  assert_raise(LibZMQ::ETERMError) { ZMQ::Pull.new(nil, context: context) }
+  assert_raise(TypeError) { ZMQ::Pull.new(nil, context: 42) }
+end
+
+assert('Socket affinity') do
+  push = ZMQ::Push.new(nil, affinity: 1)
+  assert_equal(1, push.affinity)
+  push.close
+end
+
+assert('ZMQ::Thread') do
+  thread = ZMQ::Thread.new("lambda {|pipe, n, s| pipe.send(s * n); n * 2}", 21, "a")
+  assert_equal("a" * 21, thread.pipe.recv.to_str)
+  assert_equal(42, thread.join)
+  assert_false(thread.alive?)
+
+  failing = ZMQ::Thread.new("lambda {|pipe| raise ArgumentError, 'boom'}")
+  assert_raise(ArgumentError) { failing.join }
+
+  actor = ZMQ::Thread.new("lambda {|pipe| until ZMQ::Thread.term?(pipe.recv); end; :stopped}")
+  assert_true(actor.kill)
+  assert_equal(:stopped, actor.join)
+  assert_false(actor.kill)
+
+  assert_raise(TypeError) { ZMQ::Thread.new("lambda {|pipe, o| o}", Object.new) }
+  data = [0.1 + 0.2, :sym, {"a" => [nil, true]}]
+  assert_equal(data, ZMQ::Thread.new("lambda {|pipe, *data| data}", *data).join)
+  assert_nil(ZMQ::Thread.new("lambda {|pipe| Object.new}").join)
+end
+
+assert('ZMQ::Thread which is never joined') do
+  # collecting it sends TERM, the native thread is joined once it finished
+  ZMQ::Thread.new("lambda {|pipe| until ZMQ::Thread.term?(pipe.recv); end}")
+  GC.start
+  usleep 100_000
+  assert_equal(:done, ZMQ::Thread.new("lambda {|pipe| :done}").join)
+end
+
+assert('Msg.pack') do
+  obj = [nil, true, false, 0, -1, 2**40, -2**40, 1.5, "hallo", :sym, [1, [2]], {"a" => 1, :b => [nil]}, ""]
+  msg = ZMQ::Msg.pack(obj)
+  assert_kind_of(ZMQ::Msg, msg)
+  assert_equal(obj, msg.unpack)
+  assert_equal("hallo", ZMQ::Msg.pack("hallo").unpack)
+  assert_raise(TypeError) { ZMQ::Msg.pack(Object.new) }
+  recursive = []
+  recursive << recursive
+  assert_raise(ArgumentError) { ZMQ::Msg.pack(recursive) }
+  assert_raise(ArgumentError) { ZMQ::Msg.new("\x05\x10abc").unpack }
+  assert_raise(ArgumentError) { ZMQ::Msg.new("\x00\x00").unpack }
+end
+
+assert('ZMQ::Proxy') do
+  frontend = ZMQ::Pull.new("inproc://mrb-zmq-test-proxy-frontend")
+  backend = ZMQ::Push.new("inproc://mrb-zmq-test-proxy-backend", true)
+  producer = ZMQ::Push.new("inproc://mrb-zmq-test-proxy-frontend")
+  consumer = ZMQ::Pull.new("inproc://mrb-zmq-test-proxy-backend", true)
+  proxy = ZMQ::Proxy.new(frontend, backend)
+  assert_true(proxy.running?)
+  assert_raise(Errno::ENOTSOCK) { frontend.recv }
+  producer.send("hallo")
+  assert_equal("hallo", consumer.recv.to_str)
+  if proxy.respond_to?(:statistics)
+    statistics = proxy.statistics
+    assert_equal(1, statistics[:frontend][:messages_in])
+    assert_equal(5, statistics[:backend][:bytes_out])
+  end
+  proxy.pause
+  proxy.resume
+  assert_nil(proxy.terminate)
+  assert_false(proxy.running?)
+end
+
+assert('Socket#monitor') do
+  socket = ZMQ::Pull.new
+  monitor = socket.monitor
+  socket.bind("tcp://127.0.0.1:*")
+  event = monitor.recv
+  assert_equal(:listening, event[:event])
+  assert_equal("tcp://127.0.0.1:", event[:endpoint][0, 16])
+  assert_nil(monitor.counters)
+  monitor.close
+  socket.close
+
+  socket = ZMQ::Pull.new
+  monitor = socket.monitor(counters: true)
+  assert_kind_of(Hash, monitor.counters)
+  assert_nil(monitor.close)
+  socket.close
+end
+
+assert('ZMQ::Logger') do
+  logger = ZMQ::Logger.new(nil, nil, level: :warn, stdout: false)
+  assert_false(logger.debug("hidden"))
+  assert_false(logger.info("hidden"))
+  assert_true(logger.warn("shown"))
+  assert_true(logger.log("E", "shown"))
+  logger.flush
+  stats = logger.stats
+  assert_equal(0, stats[:queued])
+  assert_equal(2, stats[:written])
+  assert_nil(logger.close)
+  assert_false(logger.error("closed"))
+  assert_equal(1, logger.stats[:dropped])
+end
+
+assert('ZMQ::Logger which never logs') do
+  # the child interpreter closes its state on exit, which used to hang on the loggers socket
+  thread = ZMQ::Thread.new(<<-CODE)
+    lambda do |pipe|
+      ZMQ::Logger.new("inproc://mrb-zmq-test-silent-logger", nil, level: :error, stdout: false).debug("filtered")
+      :done
+    end
+  CODE
+  assert_equal(:done, thread.join)
+end
+
+assert('ZMQ::Zap') do
+  class ZapTestAuthenticator < ZMQ::Zap::Authenticator
+    def plain(domain, address, identity, username, password)
+      password == "fallback" ? username : nil
+    end
+  end
+  zap = ZMQ::Zap.new(authenticator: ZapTestAuthenticator.new, allowlist: {plain: {"bob" => "secret"}})
+  server = ZMQ::Pull.new
+  server.plain_server = true
+  server.bind("tcp://127.0.0.1:*")
+  endpoint = server.last_endpoint
+
+  [["bob", "secret"], ["alice", "fallback"], ["alice", "fallback"]].each do |username, password|
+    client = ZMQ::Push.new
+    client.plain_username = username
+    client.plain_password = password
+    client.connect(endpoint)
+    zap.handle_zap
+    client.send(username)
+    assert_equal(username, server.recv.to_str)
+    client.close
+  end
+
+  stats = zap.stats
+  assert_equal(3, stats[:handshakes])
+  assert_equal(1, stats[:allowlist_hits])
+  assert_equal(1, stats[:authenticator_calls])
+  assert_equal(1, stats[:cache_hits])
+  zap.allowlist = {plain: {}}
+  assert_equal(0, zap.stats[:cache_size])
+  zap.zmq_socket.close
+  server.close
+end
+
+assert('ZMQ::Z85') do
+  hello = "\x86\x4F\xD2\x6F\xB5\x59\xF7\x5B"
+  assert_equal("HelloWorld", ZMQ::Z85.encode(hello))
+  assert_equal(hello, ZMQ::Z85.decode("HelloWorld"))
+  assert_raise(ArgumentError) { ZMQ::Z85.encode("abc") }
+  assert_raise(ArgumentError) { ZMQ::Z85.decode("Hell~") }
+  ["", "a", "ab", "abc", "abcde", "\xFF\xFF\xFF"].each do |data|
+    assert_equal(data, ZMQ::Z85.decode(ZMQ::Z85.encode(data, true), true))
+  end
+  buffer = "Z85:"
+  ZMQ::Z85.encode_into(buffer, hello)
+  ZMQ::Z85.encode_into(buffer, "ab", true)
+  assert_equal("Z85:HelloWorld", buffer[0, 14])
+  decoded = ZMQ::Z85.decode_into("", buffer[4..-1], true)
+  assert_equal(hello + "ab", decoded)
+end
+
+assert('Socket#options') do
+  socket = ZMQ::Dealer.new
+  socket.linger = 10
+  socket.routing_id = "dealer"
+  assert_equal(10, socket.linger)
+  assert_equal("dealer", socket.identity)
+  assert_false(socket.immediate?)
+  socket.bind("inproc://mrb-zmq-test-options")
+  assert_equal("inproc://mrb-zmq-test-options", socket.last_endpoint)
+  options = socket.options(:linger, "last_endpoint")
+  assert_equal({linger: 10, last_endpoint: "inproc://mrb-zmq-test-options"}, options)
+  assert_equal(10, socket.options[:linger])
+  assert_raise(ArgumentError) { socket.options(:nope) }
+  socket.close
+end
+
+if ZMQ.respond_to?(:stats_all)
+  assert('Socket#stats') do
+    pull = ZMQ::Pull.new("inproc://mrb-zmq-test-stats")
+    push = ZMQ::Push.new("inproc://mrb-zmq-test-stats")
+    push.send("hallo")
+    ZMQ::Msg.new("hallo").send(push)
+    2.times { pull.recv }
+    assert_raise(Errno::EAGAIN) { pull.recv(LibZMQ::DONTWAIT) }
+    stats = pull.stats
+    assert_equal(2, stats[:msgs_in])
+    assert_equal(10, stats[:bytes_in])
+    assert_equal(1, stats[:eagain])
+    assert_equal(2, stats[:recv_wait][:count])
+    assert_equal(2, push.stats[:msgs_out])
+    assert_equal(stats, ZMQ.stats_all[:sockets][pull])
+    push.send(["ab", "cd"])
+    push.send("efg")
+    assert_equal(2, pull.recv_many(10).size)
+    stats = pull.stats
+    assert_equal(4, stats[:msgs_in])
+    assert_equal(17, stats[:bytes_in])
+    assert_equal(4, stats[:recv_wait][:count])
+    assert_equal(1, stats[:eagain])
+    assert_equal(4, push.stats[:msgs_out])
+    assert_equal(17, push.stats[:bytes_out])
+    pull.close
+    push.close
+  end
+end
+
+if ZMQ.const_defined?("Scheduler")
+  assert('ZMQ::Scheduler') do
+    scheduler = ZMQ::Scheduler.new
+    server = ZMQ::Pair.new("inproc://mrb-zmq-test-scheduler", true)
+    client = ZMQ::Pair.new("inproc://mrb-zmq-test-scheduler")
+    replies = []
+    scheduler.spawn do
+      3.times { scheduler.send(server, scheduler.recv(server).to_str * 2) }
+    end
+    scheduler.spawn(3) do |n|
+      n.times do |i|
+        scheduler.send(client, i.to_s)
+        replies << scheduler.recv(client).to_str
+      end
+    end
+    timeouts = []
+    scheduler.spawn do
+      begin
+        scheduler.recv(ZMQ::Pull.new, 10)
+      rescue ZMQ::Scheduler::TimeoutError
+        timeouts << :recv
+      end
+      scheduler.sleep(10)
+      timeouts << :sleep
+    end
+    assert_equal(3, scheduler.size)
+    scheduler.run
+    assert_equal(0, scheduler.size)
+    assert_equal(["00", "11", "22"], replies)
+    assert_equal([:recv, :sleep], timeouts)
+    assert_raise(FiberError) { scheduler.recv(ZMQ::Pull.new) }
+  end
+end